@@ -0,0 +1,159 @@
+#include "fillfront.h"
+
+// incremental fill front used by the exemplar loop
+
+
+/*
+ * Collect every front pixel of maskMat. This is the only full-image pass;
+ * afterwards the front is maintained with update().
+ */
+void FillFront::build(const cv::Mat& maskMat)
+{
+    assert(maskMat.type() == CV_8UC1);
+
+    slot_.create(maskMat.size(), CV_32SC1);
+    slot_.setTo(-1);
+    normal_.create(maskMat.size(), CV_32FC2);
+    points_.clear();
+
+    for (int y = 0; y < maskMat.rows; ++y)
+    {
+        const uchar* maskRow = maskMat.ptr<uchar>(y);
+        for (int x = 0; x < maskMat.cols; ++x)
+        {
+            if (maskRow[x] == 0 && isFront(y, x, maskMat))
+            {
+                insert(cv::Point(x, y));
+            }
+        }
+    }
+
+    for (int i = 0; i < (int) points_.size(); ++i)
+    {
+        const cv::Point& p = points_[i];
+        normal_.ptr<cv::Point2f>(p.y)[p.x] = computeNormal(p);
+    }
+}
+
+
+/*
+ * Only pixels inside the patch centered at psiHatP and the one pixel ring
+ * around it can enter or leave the front when that patch is filled, and only
+ * normals within BORDER_RADIUS of those pixels can change.
+ */
+void FillFront::update(const cv::Point& psiHatP, const cv::Mat& maskMat, int radius)
+{
+    assert(maskMat.type() == CV_8UC1 && maskMat.size() == slot_.size());
+
+    int y0 = std::max(psiHatP.y - radius - 1, 0);
+    int y1 = std::min(psiHatP.y + radius + 1, maskMat.rows - 1);
+    int x0 = std::max(psiHatP.x - radius - 1, 0);
+    int x1 = std::min(psiHatP.x + radius + 1, maskMat.cols - 1);
+
+    for (int y = y0; y <= y1; ++y)
+    {
+        const uchar* maskRow = maskMat.ptr<uchar>(y);
+        const int* slotRow = slot_.ptr<int>(y);
+        for (int x = x0; x <= x1; ++x)
+        {
+            bool front = maskRow[x] == 0 && isFront(y, x, maskMat);
+            if (front && slotRow[x] < 0)
+            {
+                insert(cv::Point(x, y));
+            } else if (!front && slotRow[x] >= 0)
+            {
+                erase(cv::Point(x, y));
+            }
+        }
+    }
+
+    refreshNormals(
+                   std::max(y0 - BORDER_RADIUS, 0),
+                   std::min(y1 + BORDER_RADIUS, maskMat.rows - 1),
+                   std::max(x0 - BORDER_RADIUS, 0),
+                   std::min(x1 + BORDER_RADIUS, maskMat.cols - 1)
+                   );
+}
+
+
+void FillFront::refreshNormals(int y0, int y1, int x0, int x1)
+{
+    for (int y = y0; y <= y1; ++y)
+    {
+        const int* slotRow = slot_.ptr<int>(y);
+        cv::Point2f* normalRow = normal_.ptr<cv::Point2f>(y);
+        for (int x = x0; x <= x1; ++x)
+        {
+            if (slotRow[x] >= 0)
+            {
+                normalRow[x] = computeNormal(cv::Point(x, y));
+            }
+        }
+    }
+}
+
+
+/*
+ * Fit a line through the front points within BORDER_RADIUS of p with least
+ * squares.
+ */
+cv::Point2f FillFront::computeNormal(const cv::Point& p) const
+{
+    int y0 = std::max(p.y - BORDER_RADIUS, 0);
+    int y1 = std::min(p.y + BORDER_RADIUS, slot_.rows - 1);
+    int x0 = std::max(p.x - BORDER_RADIUS, 0);
+    int x1 = std::min(p.x + BORDER_RADIUS, slot_.cols - 1);
+
+    double n = 0, sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+    for (int y = y0; y <= y1; ++y)
+    {
+        const int* slotRow = slot_.ptr<int>(y);
+        for (int x = x0; x <= x1; ++x)
+        {
+            if (slotRow[x] < 0)
+                continue;
+            n += 1;
+            sumX += x;
+            sumY += y;
+            sumXX += (double) x * x;
+            sumXY += (double) x * y;
+        }
+    }
+
+    return fitNormal(n, sumX, sumY, sumXX, sumXY);
+}
+
+
+/*
+ * A target pixel is on the front if one of its 4 neighbours is source.
+ * Pixels outside the image do not count as source.
+ */
+bool FillFront::isFront(int y, int x, const cv::Mat& maskMat) const
+{
+    const uchar* maskRow = maskMat.ptr<uchar>(y);
+    return (y > 0 && maskMat.ptr<uchar>(y-1)[x] != 0) ||
+           (y < maskMat.rows-1 && maskMat.ptr<uchar>(y+1)[x] != 0) ||
+           (x > 0 && maskRow[x-1] != 0) ||
+           (x < maskMat.cols-1 && maskRow[x+1] != 0);
+}
+
+
+void FillFront::insert(const cv::Point& p)
+{
+    slot_.ptr<int>(p.y)[p.x] = (int) points_.size();
+    points_.push_back(p);
+}
+
+
+/*
+ * Swap the last point into the freed slot to keep points_ dense.
+ */
+void FillFront::erase(const cv::Point& p)
+{
+    int& slot = slot_.ptr<int>(p.y)[p.x];
+    const cv::Point last = points_.back();
+    points_[slot] = last;
+    slot_.ptr<int>(last.y)[last.x] = slot;
+    points_.pop_back();
+    slot = -1;
+}
@@ -0,0 +1,48 @@
+#ifndef FILLFRONT_H
+#define FILLFRONT_H
+
+#include "utils.h"
+
+/*
+ * The fill front of the target region: every target pixel (maskMat == 0)
+ * with at least one source pixel among its 4 neighbours. These are the same
+ * pixels cv::findContours traces on (maskMat == 0), but the front is built
+ * once from the initial mask and then kept up to date locally after each
+ * transferPatch instead of being re-traced over the whole image.
+ */
+class FillFront
+{
+public:
+    // scan maskMat (CV_8UC1, 0 for target) once and collect the front
+    void build(const cv::Mat& maskMat);
+
+    // re-evaluate the patch around psiHatP and its one pixel ring after
+    // maskMat has been updated for that patch
+    void update(const cv::Point& psiHatP, const cv::Mat& maskMat, int radius = RADIUS);
+
+    bool empty() const { return points_.empty(); }
+    size_t size() const { return points_.size(); }
+    const contour_t& points() const { return points_; }
+    bool contains(const cv::Point& p) const { return slot_.ptr<int>(p.y)[p.x] >= 0; }
+
+    // unit normal of the front at p, fitted to the front points within
+    // BORDER_RADIUS of p; looked up from the normal field
+    cv::Point2f normal(const cv::Point& p) const
+    {
+        assert(contains(p));
+        return normal_.ptr<cv::Point2f>(p.y)[p.x];
+    }
+
+private:
+    bool isFront(int y, int x, const cv::Mat& maskMat) const;
+    cv::Point2f computeNormal(const cv::Point& p) const;
+    void refreshNormals(int y0, int y1, int x0, int x1);
+    void insert(const cv::Point& p);
+    void erase(const cv::Point& p);
+
+    cv::Mat slot_;          // CV_32SC1, index of the pixel in points_ or -1
+    cv::Mat normal_;        // CV_32FC2, normal of each front pixel
+    contour_t points_;      // front pixels, unordered
+};
+
+#endif
@@ -2,118 +2,579 @@
 #include "inpainting.h"
 
 typedef Eigen::SparseMatrix<double> SpMat; // declares a column-major sparse matrix type of double
-typedef Eigen::Triplet<double> T;
 
 using namespace cv;
 using Eigen::MatrixXd;
 
-// function [filledDepth] = reconstruct(depth, fillRegion, Dx, Dy)
-// fillRegion : 0 for source
-void reconstruct(const Mat& depth, const Mat& fillRegion, const Mat& laplacian, Mat& filledDepth)  {
-    // TODO: 1. Sparse Building    2. Sparse Solving
-    CV_Assert(fillRegion.depth() == CV_8U);
-    CV_Assert(depth.depth() == CV_32F);
-    CV_Assert(laplacian.depth() == CV_32F);
-    int W = depth.cols;  // size of the image
-    int H = depth.rows;
-    int N = countNonZero(fillRegion);
-    // Assembly: Ax = b
-    std::vector<T> coefficients;            // list of non-zeros coefficients
-    Eigen::VectorXd b(N);                   // the right hand side-vector resulting from the constraints
-    
-    //---------------- Building the problem -----------------
-    coefficients.reserve(5*N);
-
-    // build the lookup table;
-    Mat lut = Mat::zeros(H, W, CV_32SC1);
-    int index = 0;
-    for( int i = 0; i < H; ++i)
-        for( int j = 0; j < W; ++j )    {
-            if (fillRegion.at<uchar>(i,j) == 0)
+// float solves are asked for no more accuracy than SINGLE_TOLERANCE, mixed
+// precision refines them at most REFINEMENT_STEPS times
+static const int REFINEMENT_STEPS = 10;
+static const double SINGLE_TOLERANCE = 1e-5;
+
+/*
+ * Initial guess of the iterative solvers, written to the fill region of out.
+ * Copies the fill region of guess when given, otherwise interpolates each row
+ * linearly between the nearest source pixels of depth to its left and right.
+ * out may be depth itself.
+ */
+static void initialGuess(const Mat& depth, const Mat& fillRegion, const Mat& guess, Mat& out)  {
+    if (!guess.empty()) {
+        CV_Assert(guess.size() == depth.size() && guess.type() == CV_32FC1);
+        guess.copyTo(out, fillRegion);
+        return;
+    }
+
+    int W = depth.cols;
+    for( int i = 0; i < depth.rows; ++i)    {
+        const uchar* fill = fillRegion.ptr<uchar>(i);
+        const float* src = depth.ptr<float>(i);
+        float* row = out.ptr<float>(i);
+        int j = 0;
+        while (j < W)   {
+            if (fill[j] == 0)   {
+                ++j;
                 continue;
-            lut.at<int>(i,j) = index;
-            index++;
+            }
+            int first = j;
+            while (j < W && fill[j] != 0)
+                ++j;
+            // run [first, j) is bounded by source pixels first-1 and j when inside the image
+            bool hasLeft = first > 0, hasRight = j < W;
+            float left = hasLeft ? src[first-1] : (hasRight ? src[j] : 0.0f);
+            float right = hasRight ? src[j] : left;
+            float span = (float) (j - first + 1);
+            for( int k = first; k < j; ++k)
+                row[k] = left + (right - left) * (k - first + 1) / span;
+        }
+    }
+}
+
+/*
+ * Bounding box of the pixels where fillRegion != 0, empty when there are none.
+ */
+static Rect fillBounds(const Mat& fillRegion)  {
+    int x0 = fillRegion.cols, y0 = fillRegion.rows, x1 = -1, y1 = -1;
+    for( int i = 0; i < fillRegion.rows; ++i)  {
+        const uchar* fill = fillRegion.ptr<uchar>(i);
+        for( int j = 0; j < fillRegion.cols; ++j )
+            if (fill[j] != 0)   {
+                x0 = std::min(x0, j);
+                x1 = std::max(x1, j);
+                y0 = std::min(y0, i);
+                y1 = i;
+            }
+    }
+    if (x1 < 0)
+        return Rect();
+    return Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+}
+
+PoissonContext::PoissonContext()
+    : split_(false), N_(0), denseReady_(false)
+{}
+
+template<typename Scalar>
+void PoissonContext::Solvers<Scalar>::reset()  {
+    negA.resize(0, 0);
+    choleskyReady = icReady = jacobiReady = false;
+}
+
+template<typename Scalar>
+int PoissonContext::Solvers<Scalar>::solve(const Dense& negB, Dense& x, PoissonSolver solver,
+                                           PoissonPreconditioner preconditioner, double tolerance, int maxIterations)  {
+    if (solver != POISSON_CG)   {
+        if (!choleskyReady) {
+            cholesky.analyzePattern(negA);   // ordering and symbolic factorization
+            cholesky.factorize(negA);        // numeric Cholesky factorization
+            choleskyReady = true;
+        }
+        x = cholesky.solve(negB);            // use the factorization to solve for all right hand sides
+        return 0;
+    }
+
+    // CG runs one column at a time
+    int iterations = 0;
+    Vector xc;
+    for (int c = 0; c < negB.cols(); ++c)   {
+        xc = x.col(c);
+        if (preconditioner == PRECONDITIONER_INCOMPLETE_CHOLESKY)   {
+            if (!icReady)   {
+                icCG.compute(negA);
+                icReady = true;
+            }
+            icCG.setTolerance(Scalar(tolerance));
+            icCG.setMaxIterations(maxIterations);
+            xc = icCG.solveWithGuess(negB.col(c), xc);
+            iterations = std::max(iterations, (int) icCG.iterations());
+        }
+        else    {
+            if (!jacobiReady)   {
+                jacobiCG.compute(negA);
+                jacobiReady = true;
+            }
+            jacobiCG.setTolerance(Scalar(tolerance));
+            jacobiCG.setMaxIterations(maxIterations);
+            xc = jacobiCG.solveWithGuess(negB.col(c), xc);
+            iterations = std::max(iterations, (int) jacobiCG.iterations());
+        }
+        x.col(c) = xc;
+    }
+    return iterations;
+}
+
+void PoissonContext::clear()  {
+    fillRegion_.release();
+    split_ = false;
+    components_.clear();
+    lut_.release();
+    solutions_.clear();
+    N_ = 0;
+    A_.resize(0, 0);
+    double_.reset();
+    single_.reset();
+    multigrid_ = PoissonMultigrid();
+    denseReady_ = false;
+}
+
+bool PoissonContext::largerComponent(const Component& a, const Component& b)  {
+    return a.area > b.area;
+}
+
+/*
+ * Solves a range of components, each one writes only its own pixels of
+ * filled.
+ */
+class PoissonContext::ComponentSolver : public ParallelLoopBody
+{
+public:
+    ComponentSolver(std::vector<Component>& components, const std::vector<Mat>& channels,
+                    const std::vector<Mat>& laplacians, std::vector<Mat>& filled, const ReconstructParams& params)
+        : components_(components), channels_(channels), laplacians_(laplacians), filled_(filled), params_(params)
+    {}
+
+    void operator()(const Range& range) const   {
+        for (int c = range.start; c < range.end; ++c)   {
+            Component& component = components_[c];
+            ReconstructParams params = params_;
+            params.components = false;
+            if (!params_.guess.empty())
+                params.guess = params_.guess(component.roi);
+
+            std::vector<Mat> channels, laplacians, out;
+            for (size_t k = 0; k < channels_.size(); ++k)   {
+                channels.push_back(channels_[k](component.roi));
+                laplacians.push_back(laplacians_[k](component.roi));
+                out.push_back(filled_[k](component.roi));
+            }
+            component.context->solve(channels, component.mask, laplacians, out, params, &component.stats);
+        }
+    }
+
+private:
+    std::vector<Component>& components_;
+    const std::vector<Mat>& channels_;
+    const std::vector<Mat>& laplacians_;
+    std::vector<Mat>& filled_;
+    const ReconstructParams& params_;
+};
+
+void PoissonContext::solveComponents(const std::vector<Mat>& channels, const std::vector<Mat>& laplacians,
+                                     std::vector<Mat>& filled, const ReconstructParams& params,
+                                     ReconstructStats* stats)  {
+    parallel_for_(Range(0, (int) components_.size()),
+                  ComponentSolver(components_, channels, laplacians, filled, params));
+
+    if (stats)  {
+        *stats = ReconstructStats();
+        for (size_t c = 0; c < components_.size(); ++c) {
+            stats->iterations = std::max(stats->iterations, components_[c].stats.iterations);
+            stats->residual = std::max(stats->residual, components_[c].stats.residual);
         }
-    
-    // Builing A and b
-    index = 0;
-    for( int i = 0; i < H; ++i)
-        for( int j = 0; j < W; ++j )    {
-            if (fillRegion.at<uchar>(i,j) == 0)
+    }
+}
+
+/*
+ * Build the state for fillRegion unless it is the mask of the previous call.
+ * Returns true when the cached state was reused.
+ */
+bool PoissonContext::setup(const Mat& fillRegion, bool components)  {
+    if (!fillRegion_.empty() && fillRegion_.size() == fillRegion.size() && split_ == components &&
+        countNonZero(fillRegion_ != fillRegion) == 0)
+        return true;
+
+    clear();
+    fillRegion_ = fillRegion.clone();
+    split_ = components;
+
+    if (components) {
+        Mat labels, stats, centroids;
+        int count = connectedComponentsWithStats(fillRegion != 0, labels, stats, centroids, 4, CV_32S);
+
+        // a single hole is solved directly by this context
+        if (count > 2)  {
+            Rect image(0, 0, fillRegion.cols, fillRegion.rows);
+            components_.resize(count - 1);
+            for (int l = 1; l < count; ++l)    {
+                Component& component = components_[l-1];
+                Rect box(stats.at<int>(l, CC_STAT_LEFT), stats.at<int>(l, CC_STAT_TOP),
+                         stats.at<int>(l, CC_STAT_WIDTH), stats.at<int>(l, CC_STAT_HEIGHT));
+                component.roi = Rect(box.x - 1, box.y - 1, box.width + 2, box.height + 2) & image;
+                component.mask = (labels(component.roi) == l);
+                component.area = stats.at<int>(l, CC_STAT_AREA);
+                component.context = makePtr<PoissonContext>();
+                N_ += component.area;
+            }
+
+            // largest first, so the parallel loop does not end on a large component
+            std::sort(components_.begin(), components_.end(), largerComponent);
+            return false;
+        }
+    }
+
+    buildSystem();
+    return false;
+}
+
+/*
+ * Index the fill pixels of fillRegion_ and build A.
+ */
+void PoissonContext::buildSystem()  {
+    const Mat& fillRegion = fillRegion_;
+    int W = fillRegion.cols;  // size of the image
+    int H = fillRegion.rows;
+
+    bbox_ = fillBounds(fillRegion);
+    if (bbox_.area() == 0)
+        return;
+
+    // index of each fill pixel in raster order, -1 for source, restricted to the bounding box
+    lut_.create(bbox_.height, bbox_.width, CV_32SC1);
+    N_ = 0;
+    for( int i = 0; i < bbox_.height; ++i)  {
+        const uchar* fill = fillRegion.ptr<uchar>(bbox_.y + i) + bbox_.x;
+        int* lut = lut_.ptr<int>(i);
+        for( int j = 0; j < bbox_.width; ++j )
+            lut[j] = fill[j] != 0 ? N_++ : -1;
+    }
+
+    // Builing A directly in compressed column storage. A is symmetric, so
+    // column k holds the neighbours of unknown k, and in raster order these
+    // are sorted as up, left, center, right, down. Every neighbour inside
+    // the image contributes -1 to the center.
+    A_.resize(N_, N_);
+    A_.resizeNonZeros(5*N_);
+    int* outer = A_.outerIndexPtr();
+    int* inner = A_.innerIndexPtr();
+    double* values = A_.valuePtr();
+    int nnz = 0;
+    for( int i = 0; i < bbox_.height; ++i)  {
+        int y = bbox_.y + i;
+        const int* lut = lut_.ptr<int>(i);
+        const int* lutUp = i > 0 ? lut_.ptr<int>(i-1) : NULL;
+        const int* lutDown = i < bbox_.height - 1 ? lut_.ptr<int>(i+1) : NULL;
+        for( int j = 0; j < bbox_.width; ++j )  {
+            int k = lut[j];
+            if (k < 0)
                 continue;
-            float v_ij = 0;
-            b[index] = laplacian.at<float>(i,j);
-            if ( i >= 1)    {
-                if ( fillRegion.at<uchar>(i-1,j) == 0 ) {    // Neighbour is in Source region
-                    b[index] -= depth.at<float>(i-1, j);
-                    v_ij -= 1;
-                }
-                else {                                       // Neighbour is in fill region
-                    v_ij -= 1;
-                    coefficients.push_back(T(index, lut.at<int>(i-1,j), 1));
+            int x = bbox_.x + j;
+            outer[k] = nnz;
+            double center = 0;
+            if (y >= 1) {
+                center -= 1;
+                if (lutUp && lutUp[j] >= 0)  {
+                    inner[nnz] = lutUp[j];
+                    values[nnz++] = 1;
                 }
             }
-            if ( i <= H - 2)    {
-                if ( fillRegion.at<uchar>(i+1,j) == 0 ) {    // Neighbour is in Source region
-                    b[index] -= depth.at<float>(i+1, j);
-                    v_ij -= 1;
-                }
-                else {                                       // Neighbour is in fill region
-                    v_ij -= 1;
-                    coefficients.push_back(T(index, lut.at<int>(i+1,j), 1));
+            if (x >= 1) {
+                center -= 1;
+                if (j > 0 && lut[j-1] >= 0)  {
+                    inner[nnz] = lut[j-1];
+                    values[nnz++] = 1;
                 }
             }
-            if ( j >= 1)    {
-                if ( fillRegion.at<uchar>(i,j-1) == 0 ) {    // Neighbour is in Source region
-                    b[index] -= depth.at<float>(i, j-1);
-                    v_ij -= 1;
+            if (x <= W - 2)
+                center -= 1;
+            if (y <= H - 2)
+                center -= 1;
+            inner[nnz] = k;
+            values[nnz++] = center;
+            if (j < bbox_.width - 1 && lut[j+1] >= 0) {
+                inner[nnz] = lut[j+1];
+                values[nnz++] = 1;
+            }
+            if (lutDown && lutDown[j] >= 0)  {
+                inner[nnz] = lutDown[j];
+                values[nnz++] = 1;
+            }
+        }
+    }
+    outer[N_] = nnz;
+    A_.resizeNonZeros(nnz);
+}
+
+/*
+ * b = laplacian - sum of the source neighbours, for every fill pixel.
+ */
+void PoissonContext::assembleRhs(const Mat& depth, const Mat& laplacian, double* b) const  {
+    int W = depth.cols;
+    int H = depth.rows;
+    for( int i = 0; i < bbox_.height; ++i)  {
+        int y = bbox_.y + i;
+        const int* lut = lut_.ptr<int>(i);
+        const float* lap = laplacian.ptr<float>(y);
+        const float* row = depth.ptr<float>(y);
+        const float* rowUp = y >= 1 ? depth.ptr<float>(y-1) : NULL;
+        const float* rowDown = y <= H - 2 ? depth.ptr<float>(y+1) : NULL;
+        const uchar* fill = fillRegion_.ptr<uchar>(y);
+        const uchar* fillUp = y >= 1 ? fillRegion_.ptr<uchar>(y-1) : NULL;
+        const uchar* fillDown = y <= H - 2 ? fillRegion_.ptr<uchar>(y+1) : NULL;
+        for( int j = 0; j < bbox_.width; ++j )  {
+            int k = lut[j];
+            if (k < 0)
+                continue;
+            int x = bbox_.x + j;
+            double b_k = lap[x];
+            if (fillUp && fillUp[x] == 0)                // Neighbour is in Source region
+                b_k -= rowUp[x];
+            if (fillDown && fillDown[x] == 0)
+                b_k -= rowDown[x];
+            if (x >= 1 && fill[x-1] == 0)
+                b_k -= row[x-1];
+            if (x <= W - 2 && fill[x+1] == 0)
+                b_k -= row[x+1];
+            b[k] = b_k;
+        }
+    }
+}
+
+// x = values of src in the fill region
+void PoissonContext::gather(const Mat& src, double* x) const  {
+    for( int i = 0; i < bbox_.height; ++i)  {
+        const int* lut = lut_.ptr<int>(i);
+        const float* row = src.ptr<float>(bbox_.y + i) + bbox_.x;
+        for( int j = 0; j < bbox_.width; ++j )
+            if (lut[j] >= 0)
+                x[lut[j]] = row[j];
+    }
+}
+
+// write x into the fill region of dst
+void PoissonContext::scatter(const double* x, Mat& dst) const  {
+    for( int i = 0; i < bbox_.height; ++i)  {
+        const int* lut = lut_.ptr<int>(i);
+        float* row = dst.ptr<float>(bbox_.y + i) + bbox_.x;
+        for( int j = 0; j < bbox_.width; ++j )
+            if (lut[j] >= 0)
+                row[j] = (float) x[lut[j]];
+    }
+}
+
+/*
+ * Largest ||R_c|| / ||B_c|| over the columns, channels with a zero right
+ * hand side are skipped.
+ */
+static double relativeResidual(const MatrixXd& R, const MatrixXd& B)  {
+    double residual = 0;
+    for (int c = 0; c < B.cols(); ++c)  {
+        double norm = B.col(c).norm();
+        if (norm > 0)
+            residual = std::max(residual, R.col(c).norm() / norm);
+    }
+    return residual;
+}
+
+// function [filledDepth] = reconstruct(depth, fillRegion, Dx, Dy)
+// fillRegion : 0 for source
+void PoissonContext::reconstruct(const Mat& depth, const Mat& fillRegion, const Mat& laplacian, Mat& filledDepth,
+                                 const ReconstructParams& params, ReconstructStats* stats)  {
+    std::vector<Mat> channels(1, depth), laplacians(1, laplacian), filled(1);
+    if (params.inPlace)
+        filled[0] = filledDepth;
+    reconstruct(channels, fillRegion, laplacians, filled, params, stats);
+    if (!params.inPlace)
+        filledDepth = filled[0];
+}
+
+void PoissonContext::reconstruct(const std::vector<Mat>& channels, const Mat& fillRegion,
+                                 const std::vector<Mat>& laplacians, std::vector<Mat>& filled,
+                                 const ReconstructParams& params, ReconstructStats* stats)  {
+    CV_Assert(fillRegion.depth() == CV_8U);
+    CV_Assert(!channels.empty() && laplacians.size() == channels.size());
+    for (size_t c = 0; c < channels.size(); ++c)    {
+        CV_Assert(channels[c].depth() == CV_32F && channels[c].size() == fillRegion.size());
+        CV_Assert(laplacians[c].depth() == CV_32F && laplacians[c].size() == fillRegion.size());
+    }
+
+    if (!params.inPlace)    {
+        filled.resize(channels.size());
+        for (size_t c = 0; c < channels.size(); ++c)
+            filled[c] = channels[c].clone();
+        solve(channels, fillRegion, laplacians, filled, params, stats);
+        return;
+    }
+
+    // only the bounding box of the hole plus the ring of its boundary pixels is touched
+    CV_Assert(filled.size() == channels.size());
+    for (size_t c = 0; c < channels.size(); ++c)
+        CV_Assert(filled[c].size() == fillRegion.size() && filled[c].type() == CV_32FC1);
+    Rect roi = fillBounds(fillRegion);
+    if (roi.area() == 0)    {
+        if (stats)
+            *stats = ReconstructStats();
+        return;
+    }
+    roi = Rect(roi.x - 1, roi.y - 1, roi.width + 2, roi.height + 2) & Rect(0, 0, fillRegion.cols, fillRegion.rows);
+
+    ReconstructParams cropParams = params;
+    if (!params.guess.empty())
+        cropParams.guess = params.guess(roi);
+    std::vector<Mat> cropChannels, cropLaplacians, out;
+    for (size_t c = 0; c < channels.size(); ++c)    {
+        cropChannels.push_back(channels[c](roi));
+        cropLaplacians.push_back(laplacians[c](roi));
+        out.push_back(filled[c](roi));
+    }
+    solve(cropChannels, fillRegion(roi), cropLaplacians, out, cropParams, stats);
+}
+
+/*
+ * Writes the fill region of every filled[c], which has the size of
+ * channels[c] and may be channels[c] itself. The other pixels are not
+ * touched. All channels share A, so the direct solvers factor it once and
+ * solve one multi-column right hand side.
+ */
+void PoissonContext::solve(const std::vector<Mat>& channels, const Mat& fillRegion,
+                           const std::vector<Mat>& laplacians, std::vector<Mat>& filled,
+                           const ReconstructParams& params, ReconstructStats* stats)  {
+    bool reused = setup(fillRegion, params.components);
+    if (!components_.empty())   {
+        solveComponents(channels, laplacians, filled, params, stats);
+        return;
+    }
+    if (N_ == 0)    {
+        if (stats)
+            *stats = ReconstructStats();
+        return;
+    }
+
+    // warm start from the caller's guess (single channel), else from the previous frame with the same mask
+    int C = (int) channels.size();
+    std::vector<Mat> guesses(C);
+    for (int c = 0; c < C; ++c) {
+        if (C == 1)
+            guesses[c] = params.guess;
+        if (guesses[c].empty() && reused && (int) solutions_.size() == C)
+            guesses[c] = solutions_[c];
+    }
+
+    int iterations = 0;
+    double residual = 0;
+    bool dense = N_ <= DENSE_UNKNOWNS;
+    if (params.solver == POISSON_MULTIGRID && !dense) {
+        // matrix-free, starts from the initial guess in the fill region
+        // the hierarchy keeps the mask it is given, so give it the context's own copy
+        if (multigrid_.empty())
+            multigrid_.setup(fillRegion_);
+        for (int c = 0; c < C; ++c) {
+            initialGuess(channels[c], fillRegion, guesses[c], filled[c]);
+            double channelResidual = 0;
+            iterations = std::max(iterations, multigrid_.solve(channels[c], laplacians[c], filled[c],
+                                                               params.tolerance, params.maxIterations,
+                                                               &channelResidual));
+            residual = std::max(residual, channelResidual);
+        }
+    }
+    else    {
+        MatrixXd B(N_, C);
+        for (int c = 0; c < C; ++c)
+            assembleRhs(channels[c], laplacians[c], B.col(c).data());
+
+        // Solve the system
+        MatrixXd X(N_, C);
+        if (dense)  {
+            // small holes, closed form for a single pixel
+            if (N_ == 1)
+                X.row(0) = B.row(0) / A_.coeff(0, 0);
+            else    {
+                if (!denseReady_)   {
+                    dense_.compute(MatrixXd(A_));
+                    denseReady_ = true;
                 }
-                else {                                       // Neighbour is in fill region
-                    v_ij -= 1;
-                    coefficients.push_back(T(index, lut.at<int>(i,j-1), 1));
+                X = dense_.solve(B);
+            }
+        }
+        else    {
+            // warm start, staged in the fill region of the output
+            if (params.solver == POISSON_CG)    {
+                for (int c = 0; c < C; ++c) {
+                    initialGuess(channels[c], fillRegion, guesses[c], filled[c]);
+                    gather(filled[c], X.col(c).data());
                 }
             }
-            if ( j <= W - 2)    {
-                if ( fillRegion.at<uchar>(i,j+1) == 0 ) {    // Neighbour is in Source region
-                    b[index] -= depth.at<float>(i, j+1);
-                    v_ij -= 1;
+            else
+                X.setZero();
+
+            // A is negative definite, the solvers run on -AX = -B
+            MatrixXd negB = -B;
+            if (params.precision == PRECISION_DOUBLE)   {
+                if (double_.negA.rows() != N_)
+                    double_.negA = -A_;
+                iterations = double_.solve(negB, X, params.solver, params.preconditioner,
+                                           params.tolerance, params.maxIterations);
+            }
+            else    {
+                if (single_.negA.rows() != N_)
+                    single_.negA = (-A_).cast<float>();
+                Eigen::MatrixXf Xf;
+                if (params.precision == PRECISION_SINGLE)   {
+                    Xf = X.cast<float>();
+                    iterations = single_.solve(negB.cast<float>(), Xf, params.solver, params.preconditioner,
+                                               std::max(params.tolerance, SINGLE_TOLERANCE), params.maxIterations);
+                    X = Xf.cast<double>();
                 }
-                else {                                       // Neighbour is in fill region
-                    v_ij -= 1;
-                    coefficients.push_back(T(index, lut.at<int>(i,j+1), 1));
+                else    {
+                    // iterative refinement, the residual and the solution are kept in double
+                    for (int step = 0; step < REFINEMENT_STEPS; ++step)   {
+                        MatrixXd R = negB + A_ * X;
+                        if (relativeResidual(R, negB) <= params.tolerance)
+                            break;
+                        Xf.setZero(N_, C);
+                        iterations += single_.solve(R.cast<float>(), Xf, params.solver, params.preconditioner,
+                                                    std::max(params.tolerance, SINGLE_TOLERANCE),
+                                                    params.maxIterations);
+                        X += Xf.cast<double>();
+                    }
                 }
             }
-            coefficients.push_back(T(index, lut.at<int>(i,j), v_ij));
-            index++;
-        }
-    
-    SpMat A(N,N);
-    A.setFromTriplets(coefficients.begin(), coefficients.end());
-    
-    // Debug: check A and b
-    // std::cout << "A = " << std::endl;
-    // std::cout << MatrixXd(A) << std::endl;
-    // std::cout << "b = " << std::endl;
-    // std::cout << b << std::endl;
-
-    // Solve the system
-    // Solving:
-    Eigen::SimplicialCholesky<SpMat> solver(A);  // performs a Cholesky factorization of A
-    Eigen::VectorXd x = solver.solve(b);         // use the factorization to solve for the given right hand side
-    
-    // Debug show x
-    // std::cout << "x = " << std::endl;
-    // std::cout << x << std::endl;
-    
-    // Filling depth
-    filledDepth = depth.clone();
-    index = 0;
-    for( int i = 0; i < H; ++i)
-        for( int j = 0; j < W; ++j )    {
-            if (fillRegion.at<uchar>(i,j) == 0)
-                continue;
-            filledDepth.at<float>(i,j) = x[index];
-            index++;
         }
-    return;
-}
\ No newline at end of file
+        if (stats)
+            residual = relativeResidual(B - A_ * X, B);
+
+        // Filling depth
+        for (int c = 0; c < C; ++c)
+            scatter(X.col(c).data(), filled[c]);
+    }
+
+    if (params.solver != POISSON_CHOLESKY && !dense)    {
+        solutions_.resize(C);
+        for (int c = 0; c < C; ++c)
+            filled[c].copyTo(solutions_[c]);
+    }
+    if (stats)  {
+        stats->iterations = iterations;
+        stats->residual = residual;
+    }
+}
+
+void reconstruct(const Mat& depth, const Mat& fillRegion, const Mat& laplacian, Mat& filledDepth,
+                 const ReconstructParams& params, ReconstructStats* stats)  {
+    PoissonContext context;
+    context.reconstruct(depth, fillRegion, laplacian, filledDepth, params, stats);
+}
+
+void reconstruct(const std::vector<Mat>& channels, const Mat& fillRegion, const std::vector<Mat>& laplacians,
+                 std::vector<Mat>& filled, const ReconstructParams& params, ReconstructStats* stats)  {
+    PoissonContext context;
+    context.reconstruct(channels, fillRegion, laplacians, filled, params, stats);
+}
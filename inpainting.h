@@ -2,11 +2,158 @@
 #define INPAINTING_H
 
 #include "utils.h"
+#include "multigrid.h"
 #include <vector>
 #include <iostream>
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
 
-void reconstruct(const cv::Mat& depth, const cv::Mat& fillRegion, const cv::Mat& laplacian, cv::Mat& filledDepth);
+enum PoissonSolver
+{
+    POISSON_CHOLESKY,       // sparse direct factorization
+    POISSON_MULTIGRID,      // matrix-free multigrid, linear in the hole size
+    POISSON_CG              // preconditioned conjugate gradients, warm started
+};
+
+enum PoissonPrecision
+{
+    PRECISION_DOUBLE,
+    PRECISION_SINGLE,       // factorization or CG in float, half the memory of the double path
+    PRECISION_MIXED         // float solves, refined against the double residual to the tolerance
+};
+
+enum PoissonPreconditioner
+{
+    PRECONDITIONER_JACOBI,
+    PRECONDITIONER_INCOMPLETE_CHOLESKY
+};
+
+struct ReconstructParams
+{
+    PoissonSolver solver;
+    double tolerance;       // iterative solvers: stop at ||b - Ax|| / ||b|| <= tolerance
+    int maxIterations;      // iterative solvers: iteration cap
+    PoissonPreconditioner preconditioner;   // POISSON_CG only
+    PoissonPrecision precision;             // POISSON_CHOLESKY and POISSON_CG only
+    bool components;        // solve each 4-connected hole as its own system, in parallel
+    bool inPlace;           // filledDepth is allocated by the caller (it may be depth itself) and only
+                            // its fill region is written, no pass outside the hole's bounding box
+    cv::Mat guess;          // iterative solvers: CV_32F initial guess of the fill region, e.g. the
+                            // previous frame's solution. Empty interpolates depth from the boundary.
+                            // Single channel solves only.
+
+    ReconstructParams()
+        : solver(POISSON_CHOLESKY), tolerance(1e-6), maxIterations(100),
+          preconditioner(PRECONDITIONER_INCOMPLETE_CHOLESKY), precision(PRECISION_DOUBLE), components(true),
+          inPlace(false)
+    {}
+};
+
+struct ReconstructStats
+{
+    int iterations;         // 0 for the direct solvers, the maximum over components
+    double residual;        // final ||b - Ax|| / ||b||, the maximum over components
+
+    ReconstructStats() : iterations(0), residual(0) {}
+};
+
+/*
+ * Solver state of reconstruct() for one fill region. The system matrix only
+ * depends on the mask, so as long as consecutive calls pass an identical
+ * fillRegion, the assembly, the ordering and symbolic analysis, the numeric
+ * factorization (or preconditioner, or multigrid hierarchy) are kept and only
+ * the right hand side is rebuilt. A changed mask rebuilds everything.
+ *
+ * Disjoint holes are independent, so with ReconstructParams::components the
+ * context keeps one child context per 4-connected component, cropped to the
+ * component's bounding box plus a one pixel ring, and solves them in
+ * parallel. Components of up to DENSE_UNKNOWNS pixels use a dense solve.
+ */
+class PoissonContext
+{
+public:
+    PoissonContext();
+
+    void reconstruct(const cv::Mat& depth, const cv::Mat& fillRegion, const cv::Mat& laplacian, cv::Mat& filledDepth,
+                     const ReconstructParams& params = ReconstructParams(), ReconstructStats* stats = NULL);
+
+    // solve several CV_32F channels (depth, color channels, ...) with the same fill region
+    // and their own laplacians, the factorization is shared by all of them
+    void reconstruct(const std::vector<cv::Mat>& channels, const cv::Mat& fillRegion,
+                     const std::vector<cv::Mat>& laplacians, std::vector<cv::Mat>& filled,
+                     const ReconstructParams& params = ReconstructParams(), ReconstructStats* stats = NULL);
+
+    // drop the cached mask and factorizations
+    void clear();
+
+    static const int DENSE_UNKNOWNS = 64;
+
+private:
+    typedef Eigen::SparseMatrix<double> SpMat;
+
+    struct Component
+    {
+        cv::Rect roi;           // bounding box of the component plus a one pixel ring, clipped to the image
+        cv::Mat mask;           // CV_8UC1 within roi, 255 for the component
+        int area;               // number of pixels
+        cv::Ptr<PoissonContext> context;
+        ReconstructStats stats;
+    };
+    // sparse solvers of -Ax = -b in one precision, -A is positive definite
+    template<typename Scalar>
+    struct Solvers
+    {
+        typedef Eigen::SparseMatrix<Scalar> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Dense;
+
+        Matrix negA;
+        Eigen::SimplicialCholesky<Matrix> cholesky;
+        Eigen::ConjugateGradient<Matrix, Eigen::Lower|Eigen::Upper, Eigen::IncompleteCholesky<Scalar> > icCG;
+        Eigen::ConjugateGradient<Matrix, Eigen::Lower|Eigen::Upper, Eigen::DiagonalPreconditioner<Scalar> > jacobiCG;
+        bool choleskyReady, icReady, jacobiReady;
+
+        Solvers() : choleskyReady(false), icReady(false), jacobiReady(false) {}
+        void reset();
+        // one column per right hand side, x is the warm start of CG; returns the number of iterations
+        int solve(const Dense& negB, Dense& x, PoissonSolver solver, PoissonPreconditioner preconditioner,
+                  double tolerance, int maxIterations);
+    };
+    class ComponentSolver;
+    static bool largerComponent(const Component& a, const Component& b);
+
+    bool setup(const cv::Mat& fillRegion, bool components);
+    void buildSystem();
+    void solve(const std::vector<cv::Mat>& channels, const cv::Mat& fillRegion,
+               const std::vector<cv::Mat>& laplacians, std::vector<cv::Mat>& filled,
+               const ReconstructParams& params, ReconstructStats* stats);
+    void solveComponents(const std::vector<cv::Mat>& channels, const std::vector<cv::Mat>& laplacians,
+                         std::vector<cv::Mat>& filled, const ReconstructParams& params, ReconstructStats* stats);
+    void assembleRhs(const cv::Mat& depth, const cv::Mat& laplacian, double* b) const;
+    void gather(const cv::Mat& src, double* x) const;
+    void scatter(const double* x, cv::Mat& dst) const;
+
+    cv::Mat fillRegion_;        // mask the cached state belongs to
+    bool split_;                // fillRegion_ was split into components_
+    std::vector<Component> components_;
+    cv::Rect bbox_;             // bounding box of the fill region
+    cv::Mat lut_;               // index of each fill pixel in x, -1 for source, within bbox_
+    int N_;
+    SpMat A_;
+    std::vector<cv::Mat> solutions_;    // last filled channels, warm start of the next frame
+
+    Eigen::LDLT<Eigen::MatrixXd> dense_;
+    Solvers<double> double_;
+    Solvers<float> single_;
+    PoissonMultigrid multigrid_;
+    bool denseReady_;
+};
+
+// one-shot solve, use a PoissonContext to reuse work across frames with the same mask
+void reconstruct(const cv::Mat& depth, const cv::Mat& fillRegion, const cv::Mat& laplacian, cv::Mat& filledDepth,
+                 const ReconstructParams& params = ReconstructParams(), ReconstructStats* stats = NULL);
+void reconstruct(const std::vector<cv::Mat>& channels, const cv::Mat& fillRegion, const std::vector<cv::Mat>& laplacians,
+                 std::vector<cv::Mat>& filled,
+                 const ReconstructParams& params = ReconstructParams(), ReconstructStats* stats = NULL);
 
 #endif
@@ -0,0 +1,63 @@
+#include "isophotes.h"
+
+// cached isophote fields for computePriority
+
+
+void IsophoteCache::build(const cv::Mat& grayMat, const cv::Mat& confidenceMat)
+{
+    assert(grayMat.type() == CV_32FC1 && confidenceMat.type() == CV_32FC1);
+    assert(grayMat.size() == confidenceMat.size());
+
+    dx_.create(grayMat.size(), CV_32FC1);
+    dy_.create(grayMat.size(), CV_32FC1);
+    masked_.create(grayMat.size(), CV_32FC1);
+    eroded_.create(grayMat.size(), CV_32FC1);
+
+    refresh(cv::Rect(0, 0, grayMat.cols, grayMat.rows), grayMat, confidenceMat);
+}
+
+
+/*
+ * The transfer changes grayMat and the mask inside the patch only. The 3x3
+ * derivative kernel spreads that change by one pixel and the 3x3 erosion
+ * by one more.
+ */
+void IsophoteCache::update(const cv::Point& psiHatP, const cv::Mat& grayMat, const cv::Mat& confidenceMat, int radius)
+{
+    assert(grayMat.size() == dx_.size() && confidenceMat.size() == dx_.size());
+
+    cv::Rect dirty(
+                   psiHatP.x - radius - 1,
+                   psiHatP.y - radius - 1,
+                   2*radius + 3,
+                   2*radius + 3
+                   );
+    refresh(dirty & cv::Rect(0, 0, grayMat.cols, grayMat.rows), grayMat, confidenceMat);
+}
+
+
+/*
+ * Recompute the derivatives and the masked magnitude inside rect and the
+ * eroded magnitude inside rect plus one pixel. Filtering an ROI reads the
+ * pixels around it from the parent image, so the result is identical to
+ * filtering the whole image.
+ */
+void IsophoteCache::refresh(const cv::Rect& rect, const cv::Mat& grayMat, const cv::Mat& confidenceMat)
+{
+    cv::Mat dx = dx_(rect);
+    cv::Mat dy = dy_(rect);
+    getDerivatives(grayMat(rect), dx, dy);
+
+    cv::Mat magnitude;
+    cv::magnitude(dx, dy, magnitude);
+
+    // mask the magnitude
+    cv::Mat masked = masked_(rect);
+    masked.setTo(0.0f);
+    magnitude.copyTo(masked, (confidenceMat(rect) != 0.0f));
+
+    cv::Rect erodeRect(rect.x - 1, rect.y - 1, rect.width + 2, rect.height + 2);
+    erodeRect &= cv::Rect(0, 0, grayMat.cols, grayMat.rows);
+    cv::Mat eroded = eroded_(erodeRect);
+    cv::erode(masked_(erodeRect), eroded, cv::Mat());
+}
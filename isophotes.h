@@ -0,0 +1,34 @@
+#ifndef ISOPHOTES_H
+#define ISOPHOTES_H
+
+#include "utils.h"
+
+/*
+ * Gradient fields of the greyscale image used for the data term of the
+ * priority: the derivatives dx, dy and the gradient magnitude restricted to
+ * the source region and eroded by one pixel. The fields are computed once
+ * and then only recomputed in the dirty rectangle around each filled patch.
+ */
+class IsophoteCache
+{
+public:
+    // compute every field over the whole image
+    void build(const cv::Mat& grayMat, const cv::Mat& confidenceMat);
+
+    // refresh the fields after the patch centered at psiHatP has been
+    // transferred into grayMat and its confidence set
+    void update(const cv::Point& psiHatP, const cv::Mat& grayMat, const cv::Mat& confidenceMat, int radius = RADIUS);
+
+    const cv::Mat& dx() const { return dx_; }
+    const cv::Mat& dy() const { return dy_; }
+    const cv::Mat& maskedMagnitude() const { return eroded_; }
+
+private:
+    void refresh(const cv::Rect& rect, const cv::Mat& grayMat, const cv::Mat& confidenceMat);
+
+    cv::Mat dx_, dy_;       // derivatives of grayMat
+    cv::Mat masked_;        // gradient magnitude, 0 in the target region
+    cv::Mat eroded_;        // masked_ eroded with a 3x3 kernel
+};
+
+#endif
@@ -9,18 +9,22 @@
 #include <string>
 
 #include "utils.h"
+#include "session.h"
+#include "pyramid.h"
+#include "ssd.h"
 #include "inpainting.h"
 
 using namespace std;
 
 #define DEBUG 0
 
-// Parameters
-double scale = 0.5;
-
 
 /*
 int main (int argc, char** argv) {
+    // Parameters
+    // coarse-to-fine driver, the coarsest level uses the exhaustive search as the reference
+    PyramidParams pyramidParams;
+
     // --------------- read filename strings ------------------
     std::string colorFilename, depthFilename, maskFilename;
     
@@ -36,10 +40,9 @@ int main (int argc, char** argv) {
     
     // ---------------- read the images ------------------------
     // colorMat     - color picture + border
-    // maskMat      - mask picture + border
+    // maskMat      - mask picture
     // depthMat     - depth 
-    // grayMat      - gray picture + border
-    cv::Mat colorMat, depthMat, maskMat, grayMat;
+    cv::Mat colorMat, depthMat, maskMat;
     loadInpaintingImages(
                         colorFilename,
                         depthFilename,
@@ -47,124 +50,33 @@ int main (int argc, char** argv) {
                         colorMat,
                         depthMat,
                         maskMat,
-                        scale);
-    
-    cv::cvtColor(colorMat, grayMat, CV_BGR2GRAY);
+                        1.0,
+                        pyramidParams.coarse.radius);
     
     if (DEBUG) {
         showMat("mask", maskMat, 0);
     }
-    // confidenceMat - confidence picture + border
-    // maskMat type: 1 for source, 0 for mask
-    cv::Mat confidenceMat;
-    maskMat.convertTo(confidenceMat, CV_32F);
-    confidenceMat /= 255.0f;
-
-    // add borders around maskMat and confidenceMat
-    cv::copyMakeBorder(maskMat, maskMat,
-                       RADIUS, RADIUS, RADIUS, RADIUS,
-                       cv::BORDER_CONSTANT, 255);
-    cv::copyMakeBorder(confidenceMat, confidenceMat,
-                       RADIUS, RADIUS, RADIUS, RADIUS,
-                       cv::BORDER_CONSTANT, 0.0001f);
     
     // ---------------- start the algorithm -----------------
     
-    contours_t contours;            // mask contours
-    hierarchy_t hierarchy;          // contours hierarchy
-    
-    
-    // priorityMat - priority values for all contour points + border
-    cv::Mat priorityMat(
-                        confidenceMat.size(),
-                        CV_32FC1
-                        );  // priority value matrix for each contour point
-    
-    assert(
-           colorMat.size() == grayMat.size() &&
-           colorMat.size() == confidenceMat.size() &&
-           colorMat.size() == maskMat.size()
-           );
-    
-    cv::Point psiHatP;          // psiHatP - point of highest confidence
-    
-    cv::Mat psiHatPColor;       // color patch around psiHatP
-    
-    cv::Mat psiHatPConfidence;  // confidence patch around psiHatP
-    double confidence;          // confidence of psiHatPConfidence
-    
-    cv::Point psiHatQ;          // psiHatQ - point of closest patch
-    
-    cv::Mat result;             // holds result from template matching
-    cv::Mat erodedMask;         // eroded mask
-    
-    cv::Mat templateMask;       // mask for template match (3 channel)
-    
-    // eroded mask is used to ensure that psiHatQ is not overlapping with target
-    cv::erode(maskMat, erodedMask, cv::Mat(), cv::Point(-1, -1), RADIUS);
-    
-    cv::Mat drawMat;
-    
+    int radius = pyramidParams.coarse.radius;
+    cv::Mat color = colorMat(cv::Rect(radius, radius, maskMat.cols, maskMat.rows));
+    cv::Mat depth = depthMat(cv::Rect(radius, radius, maskMat.cols, maskMat.rows));
+    cv::Mat filledMat, filledDepthMat;
     
-    // main loop
-    const size_t area = maskMat.total();
+    // color and depth are matched and filled together
+    PyramidInpainter inpainter(pyramidParams);
+    inpainter.process(color, depth, maskMat, filledMat, filledDepthMat);
     
-    while (cv::countNonZero(maskMat) != area)   // end when target is filled
-    {
-        // set priority matrix to -.1, lower than 0 so that border area is never selected
-        priorityMat.setTo(-0.1f);
-        
-        // get the contours of mask
-        getContours((maskMat == 0), contours, hierarchy);
-        
-        if (DEBUG) {
-            drawMat = colorMat.clone();
-        }
-        
-        // compute the priority for all contour points
-        computePriority(contours, grayMat, confidenceMat, priorityMat);
-        
-        // get the patch with the greatest priority
-        cv::minMaxLoc(priorityMat, NULL, NULL, NULL, &psiHatP);
-        psiHatPColor = getPatch(colorMat, psiHatP);
-        psiHatPConfidence = getPatch(confidenceMat, psiHatP);
-        
-        cv::Mat confInv = (psiHatPConfidence != 0.0f);
-        confInv.convertTo(confInv, CV_32F);
-        confInv /= 255.0f;
-        // get the patch in source with least distance to psiHatPColor wrt source of psiHatP
-        cv::Mat mergeArrays[3] = {confInv, confInv, confInv};
-        cv::merge(mergeArrays, 3, templateMask);
-        result = computeSSD(psiHatPColor, colorMat, templateMask);
-        
-        // set all target regions to 1.1, which is over the maximum value possilbe
-        // from SSD
-        result.setTo(1.1f, erodedMask == 0);
-        // get minimum point of SSD between psiHatPColor and colorMat
-        cv::minMaxLoc(result, NULL, NULL, &psiHatQ);
-        
-        assert(psiHatQ != psiHatP);
-        
-        if (DEBUG) {
-            cv::rectangle(drawMat, psiHatP - cv::Point(RADIUS, RADIUS), psiHatP + cv::Point(RADIUS+1, RADIUS+1), cv::Scalar(255, 0, 0));
-            cv::rectangle(drawMat, psiHatQ - cv::Point(RADIUS, RADIUS), psiHatQ + cv::Point(RADIUS+1, RADIUS+1), cv::Scalar(0, 0, 255));
-            showMat("red - psiHatQ", drawMat);
-        }
-        // updates
-        // copy from psiHatQ to psiHatP for each colorspace
-        transferPatch(psiHatQ, psiHatP, grayMat, (maskMat == 0));
-        transferPatch(psiHatQ, psiHatP, colorMat, (maskMat == 0));
-        
-        // fill in confidenceMat with confidences C(pixel) = C(psiHatP)
-        confidence = computeConfidence(psiHatPConfidence);
-        assert(0 <= confidence && confidence <= 1.0f);
-        // update confidence
-        psiHatPConfidence.setTo(confidence, (psiHatPConfidence == 0.0f));
-        // update maskMat
-        maskMat = (confidenceMat != 0.0f);
+    if (DEBUG) {
+        std::cout << "levels: " << inpainter.levels() << std::endl;
     }
     
-    showMat("final result", colorMat, 0);
+    // filledDepthMat is in the unit of the depth file
+    cv::Mat shownDepth;
+    cv::normalize(filledDepthMat, shownDepth, 0.0, 1.0, cv::NORM_MINMAX);
+    showMat("final depth", shownDepth);
+    showMat("final result", filledMat, 0);
     return 0;
 }
 */
@@ -201,6 +113,332 @@ int main (int argc, char** argv) {
     printMat(A, "A");
     printMat(fillRegion, "fillRegion");
     printMat(filled, "filled");
+    
+    // 5 unknowns take the dense path of every solver, Test 6 runs the multigrid cycles
+    ReconstructParams multigridParams;
+    multigridParams.solver = POISSON_MULTIGRID;
+    reconstruct(A, fillRegion, laplacian, filled, multigridParams);
+    printMat(filled, "filled (multigrid)");
+
+    ReconstructParams cgParams;
+    cgParams.solver = POISSON_CG;
+    ReconstructStats cgStats;
+    reconstruct(A, fillRegion, laplacian, filled, cgParams, &cgStats);
+    printMat(filled, "filled (CG)");
+    cout << "CG iterations: " << cgStats.iterations << ", residual: " << cgStats.residual << endl;
+
+    // in place, only the fill region of the caller's buffer is written
+    ReconstructParams inPlaceParams;
+    inPlaceParams.inPlace = true;
+    filled = A.clone();
+    reconstruct(filled, fillRegion, laplacian, filled, inPlaceParams);
+    printMat(filled, "filled (in place)");
+
+    // Test 5 Masked SSD kernel against computeSSD
+    cout << "-------------- Masked SSD --------------" << endl;
+    
+    cv::Mat image(64, 64, CV_32FC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::Point target(20, 30);
+    cv::Mat tmplate = getPatch(image, target).clone();
+    cv::Mat tmplateMask(tmplate.size(), CV_8UC1);
+    cv::randu(tmplateMask, 0, 2);
+    tmplateMask *= 255;
+    
+    cv::Mat known, templateMask;
+    tmplateMask.convertTo(known, CV_32F, 1.0 / 255.0);
+    cv::Mat mergeArrays[3] = {known, known, known};
+    cv::merge(mergeArrays, 3, templateMask);
+    cv::Mat reference = computeSSD(tmplate, image, templateMask);
+    
+    MaskedTemplate<RADIUS> t;
+    t.set(tmplate, tmplateMask);
+    cv::Mat ssd(image.rows - 2*RADIUS, image.cols - 2*RADIUS, CV_32F);
+    for (int y = 0; y < ssd.rows; ++y)
+        for (int x = 0; x < ssd.cols; ++x)
+            ssd.at<float>(y, x) = maskedSSD(t, image.ptr<float>(y) + 3*x, image.step1());
+    cv::normalize(ssd, ssd, 0, 1, cv::NORM_MINMAX);
+    
+    cv::Point refMin, ssdMin;
+    cv::Mat referenceValid = reference(cv::Rect(RADIUS, RADIUS, ssd.cols, ssd.rows));
+    cv::minMaxLoc(referenceValid, NULL, NULL, &refMin);
+    cv::minMaxLoc(ssd, NULL, NULL, &ssdMin);
+    cout << "max difference = " << cv::norm(ssd, referenceValid, cv::NORM_INF) << endl;
+    cout << "argmin equal = " << (refMin == ssdMin) << endl;
+
+    // RGB-D, weighted depth as the fourth interleaved channel
+    cv::Mat rgbd(image.size(), CV_32FC4);
+    cv::randu(rgbd, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::Mat rgbdTemplate = getPatch(rgbd, target).clone();
+    cv::Mat rgbdMask;
+    cv::Mat rgbdMergeArrays[4] = {known, known, known, known};
+    cv::merge(rgbdMergeArrays, 4, rgbdMask);
+    cv::Mat rgbdReference = computeSSD(rgbdTemplate, rgbd, rgbdMask);
+
+    MaskedTemplate<RADIUS, 4> rgbdTarget;
+    rgbdTarget.set(rgbdTemplate, tmplateMask);
+    cv::Mat rgbdSSD(ssd.size(), CV_32F);
+    for (int y = 0; y < rgbdSSD.rows; ++y)
+        for (int x = 0; x < rgbdSSD.cols; ++x)
+            rgbdSSD.at<float>(y, x) = maskedSSD(rgbdTarget, rgbd.ptr<float>(y) + 4*x, rgbd.step1());
+    cv::normalize(rgbdSSD, rgbdSSD, 0, 1, cv::NORM_MINMAX);
+    cout << "RGB-D max difference = "
+         << cv::norm(rgbdSSD, rgbdReference(cv::Rect(RADIUS, RADIUS, ssd.cols, ssd.rows)), cv::NORM_INF) << endl;
+    
+    // throughput of the kernel over every candidate
+    const int repeats = 200;
+    float sink = 0.0f;
+    int64 start = cv::getTickCount();
+    for (int r = 0; r < repeats; ++r)
+        for (int y = 0; y < ssd.rows; ++y)
+            for (int x = 0; x < ssd.cols; ++x)
+                sink += maskedSSD(t, image.ptr<float>(y) + 3*x, image.step1());
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    cout << "maskedSSD: " << repeats * ssd.total() / seconds / 1e6 << " Mcandidates/s (" << sink << ")" << endl;
+    
+    start = cv::getTickCount();
+    for (int r = 0; r < repeats / 10; ++r)
+        reference = computeSSD(tmplate, image, templateMask);
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    cout << "computeSSD: " << repeats / 10 * ssd.total() / seconds / 1e6 << " Mcandidates/s" << endl;
+
+    // 8 bit search image, a quarter of the bytes per candidate
+    cv::Mat image8;
+    image.convertTo(image8, CV_8U, 255.0);
+    QuantizedTemplate<RADIUS, 3> t8;
+    t8.set(getPatch(image8, target).clone(), tmplateMask);
+    cv::Mat ssd8(ssd.size(), CV_32F);
+    for (int y = 0; y < ssd8.rows; ++y)
+        for (int x = 0; x < ssd8.cols; ++x)
+            ssd8.at<float>(y, x) = maskedSSD(t8, image8.ptr<uchar>(y) + 3*x, image8.step1());
+    cv::Point ssd8Min;
+    cv::minMaxLoc(ssd8, NULL, NULL, &ssd8Min);
+    cout << "quantized argmin equal = " << (ssd8Min == ssdMin) << endl;
+
+    start = cv::getTickCount();
+    for (int r = 0; r < repeats; ++r)
+        for (int y = 0; y < ssd8.rows; ++y)
+            for (int x = 0; x < ssd8.cols; ++x)
+                sink += maskedSSD(t8, image8.ptr<uchar>(y) + 3*x, image8.step1());
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    cout << "quantized maskedSSD: " << repeats * ssd8.total() / seconds / 1e6 << " Mcandidates/s (" << sink << ")" << endl;
+
+    // quantized RGB-D search on textured color and depth in millimeters, normalized as a session does.
+    // The target patch is repeated once before the hole is cut, so both searches must find that copy
+    cv::Mat rampColor(120 + 2*RADIUS, 160 + 2*RADIUS, CV_32FC3);
+    cv::randu(rampColor, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::Mat rampDepth(rampColor.size(), CV_32FC1);
+    for (int y = 0; y < rampDepth.rows; ++y)
+        for (int x = 0; x < rampDepth.cols; ++x)
+            rampDepth.at<float>(y, x) = 500.0f + 25.0f * x + 10.0f * y;
+    const cv::Point rampP(80, 60), rampCopy(50, 35);
+    getPatch(rampColor, rampP).copyTo(getPatch(rampColor, rampCopy));
+    getPatch(rampDepth, rampP).copyTo(getPatch(rampDepth, rampCopy));
+    cv::Mat rampMask(rampColor.size(), CV_8UC1, cv::Scalar(255)), rampEroded;
+    rampMask(cv::Rect(80, 60, 20, 20)).setTo(0);
+    cv::erode(rampMask, rampEroded, cv::Mat(), cv::Point(-1, -1), RADIUS);
+
+    cv::Mat rampNormalized;
+    double rampScale, rampOffset;
+    normalizeDepth(rampDepth, rampMask, rampNormalized, rampScale, rampOffset);
+    cv::Mat ramp(rampColor.size(), CV_32FC4);
+    cv::Mat rampPlanes[2] = {rampColor, rampNormalized};
+    const int rampFromTo[] = {0, 0, 1, 1, 2, 2, 3, 3};
+    cv::mixChannels(rampPlanes, 2, &ramp, 1, rampFromTo, 4);
+
+    SearchParams rampParams;
+    rampParams.strategy = SEARCH_WINDOW;
+    cv::Point rampQ[2];
+    for (int q = 0; q < 2; ++q) {
+        rampParams.quantized = (q == 1);
+        PatchSearch rampSearch;
+        rampSearch.init(rampParams, ramp, rampMask, rampEroded);
+        rampSearch.find(rampP, ramp, getPatch(rampMask, rampP), rampQ[q]);
+    }
+    cout << "millimeter depth: float found the copy = " << (rampQ[0] == rampCopy)
+         << ", quantized argmin equal = " << (rampQ[1] == rampQ[0]) << endl;
+
+    // Test 6 Poisson precision on a smooth depth frame with a large hole
+    cout << "-------------- Poisson Precision --------------" << endl;
+
+    cv::Mat depthFrame(480, 640, CV_32F);
+    for (int y = 0; y < depthFrame.rows; ++y)
+        for (int x = 0; x < depthFrame.cols; ++x)
+            depthFrame.at<float>(y, x) = 1.0f + 0.5f * std::sin(x * 0.02f) * std::cos(y * 0.03f);
+    cv::Mat depthHole = cv::Mat::zeros(depthFrame.size(), CV_8UC1);
+    cv::circle(depthHole, cv::Point(320, 240), 150, cv::Scalar(255), -1);
+    cv::Mat depthLaplacian;
+    computeLaplacian(depthFrame, depthLaplacian);
+
+    cv::Mat exact;
+    reconstruct(depthFrame, depthHole, depthLaplacian, exact);
+    const char* precisionNames[] = {"double", "single", "mixed"};
+    const char* solverNames[] = {"cholesky", "multigrid", "cg"};
+    PoissonSolver precisionSolvers[] = {POISSON_CHOLESKY, POISSON_MULTIGRID, POISSON_CG};
+    for (int s = 0; s < 3; ++s)
+        for (int p = PRECISION_DOUBLE; p <= PRECISION_MIXED; ++p)   {
+            // multigrid always runs in double, its V-cycles run on the full disc here
+            if (precisionSolvers[s] == POISSON_MULTIGRID && p != PRECISION_DOUBLE)
+                continue;
+            ReconstructParams precisionParams;
+            precisionParams.solver = precisionSolvers[s];
+            precisionParams.precision = (PoissonPrecision) p;
+            precisionParams.maxIterations = 1000;
+            ReconstructStats precisionStats;
+            start = cv::getTickCount();
+            reconstruct(depthFrame, depthHole, depthLaplacian, filled, precisionParams, &precisionStats);
+            seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+            cout << solverNames[precisionSolvers[s]] << " " << precisionNames[p] << ": " << seconds * 1000 << " ms, "
+                 << precisionStats.iterations << " iterations, residual " << precisionStats.residual
+                 << ", max difference " << cv::norm(filled, exact, cv::NORM_INF) << endl;
+        }
+
+    // the second frame with the same mask reuses the preconditioner and warm starts from the first
+    cv::Mat nextFrame(depthFrame.size(), CV_32F), nextLaplacian;
+    for (int y = 0; y < nextFrame.rows; ++y)
+        for (int x = 0; x < nextFrame.cols; ++x)
+            nextFrame.at<float>(y, x) = 1.0f + 0.5f * std::sin((x + 2) * 0.02f) * std::cos(y * 0.03f);
+    computeLaplacian(nextFrame, nextLaplacian);
+    PoissonContext context;
+    ReconstructParams reuseParams;
+    reuseParams.solver = POISSON_CG;
+    reuseParams.maxIterations = 1000;
+    ReconstructStats firstStats, reusedStats;
+    start = cv::getTickCount();
+    context.reconstruct(depthFrame, depthHole, depthLaplacian, filled, reuseParams, &firstStats);
+    double firstSeconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    start = cv::getTickCount();
+    context.reconstruct(nextFrame, depthHole, nextLaplacian, filled, reuseParams, &reusedStats);
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    cout << "CG first frame: " << firstSeconds * 1000 << " ms, " << firstStats.iterations << " iterations; "
+         << "reused context: " << seconds * 1000 << " ms, " << reusedStats.iterations << " iterations" << endl;
+
+    // Test 7 batched channels share one factorization
+    cout << "-------------- Batched Channels --------------" << endl;
+
+    std::vector<cv::Mat> channels(3), channelLaplacians(3), channelsFilled;
+    for (int c = 0; c < 3; ++c) {
+        channels[c] = depthFrame * (c + 1);
+        computeLaplacian(channels[c], channelLaplacians[c]);
+    }
+    start = cv::getTickCount();
+    reconstruct(channels, depthHole, channelLaplacians, channelsFilled);
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    cout << "3 channels: " << seconds * 1000 << " ms" << endl;
+    for (int c = 0; c < 3; ++c)
+        cout << "channel " << c << " max difference " << cv::norm(channelsFilled[c], exact * (c + 1), cv::NORM_INF) << endl;
+
+    // Test 8 coarse-to-fine against single level PatchMatch inpainting, the fastest full resolution search
+    cout << "-------------- Pyramid Inpainting --------------" << endl;
+
+    cv::Mat texture(240, 320, CV_32FC3);
+    for (int y = 0; y < texture.rows; ++y)
+        for (int x = 0; x < texture.cols; ++x)
+            texture.at<cv::Vec3f>(y, x) = cv::Vec3f(0.5f + 0.5f * std::sin(x * 0.3f),
+                                                    0.5f + 0.5f * std::cos(y * 0.2f),
+                                                    ((x / 8 + y / 8) % 2) ? 0.8f : 0.2f);
+    cv::Mat textureMask(texture.size(), CV_8UC1, cv::Scalar(255));
+    cv::circle(textureMask, cv::Point(160, 120), 50, cv::Scalar(0), -1);
+    cv::Mat textureHole = (textureMask == 0);
+
+    cv::Mat singleFilled, pyramidFilled;
+    InpaintingSession single;
+    SearchParams singleParams;
+    singleParams.strategy = SEARCH_PATCHMATCH;
+    start = cv::getTickCount();
+    single.reset(texture, textureMask, singleParams);
+    single.run();
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    singleFilled = single.colorMat(cv::Rect(RADIUS, RADIUS, texture.cols, texture.rows));
+    cout << "single level PatchMatch: " << seconds * 1000 << " ms, mean error "
+         << cv::mean(cv::abs(singleFilled - texture), textureHole) << endl;
+
+    PyramidInpainter pyramid;
+    start = cv::getTickCount();
+    pyramid.process(texture, textureMask, pyramidFilled);
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    cout << "pyramid (" << pyramid.levels() << " levels): " << seconds * 1000 << " ms, mean error "
+         << cv::mean(cv::abs(pyramidFilled - texture), textureHole) << endl;
+
+    // a frame without a hole comes back unchanged
+    cv::Mat noHole(texture.size(), CV_8UC1, cv::Scalar(255));
+    pyramid.process(texture, noHole, pyramidFilled);
+    cout << "pyramid without hole (" << pyramid.levels() << " levels): max difference "
+         << cv::norm(pyramidFilled, texture, cv::NORM_INF) << endl;
+
+    // Test 9 patch distance and copy of one RGB-D step in two layouts. The separate layout is the
+    // session's before color and depth were interleaved: a CV_32FC3 color and a CV_32FC1 depth plane,
+    // each matched with its own masked SSD pass and copied on its own. The working image layout
+    // matches and copies one CV_32FC4 plane. Both copy the gray plane, the confidence and mask
+    // updates are the same in both and left out. A color only step on the CV_32FC3 working image
+    // is timed last. Traffic is counted from the element size of the planes each step touches:
+    // template and candidate reads of every matched plane, a read and a write of every copied one.
+    cout << "-------------- Working Image Layout --------------" << endl;
+
+    cv::Mat planeColor(480, 640, CV_32FC3), planeDepth(480, 640, CV_32FC1), planeGray(480, 640, CV_32FC1);
+    cv::randu(planeColor, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::randu(planeDepth, cv::Scalar::all(0), cv::Scalar::all(1));
+    cv::cvtColor(planeColor, planeGray, CV_BGR2GRAY);
+    cv::Mat work(480, 640, CV_32FC4);
+    cv::Mat planes[2] = {planeColor, planeDepth};
+    const int fromTo[] = {0, 0, 1, 1, 2, 2, 3, 3};
+    cv::mixChannels(planes, 2, &work, 1, fromTo, 4);
+    cv::Mat workColor = planeColor.clone(), workGray = planeGray.clone();
+    cv::Mat copyMask = (tmplateMask == 0);
+
+    const int steps = 20000;
+    const double patchArea = (2*RADIUS + 1) * (2*RADIUS + 1);
+    std::vector<cv::Point> ps(steps), qs(steps);
+    cv::RNG layoutRng(7);
+    for (int i = 0; i < steps; ++i) {
+        ps[i] = cv::Point(layoutRng.uniform(RADIUS, 640 - RADIUS), layoutRng.uniform(RADIUS, 480 - RADIUS));
+        qs[i] = cv::Point(layoutRng.uniform(RADIUS, 640 - RADIUS), layoutRng.uniform(RADIUS, 480 - RADIUS));
+    }
+
+    // separate planes: color and depth distance in two passes, three plane copies
+    MaskedTemplate<RADIUS, 3> colorTarget;
+    MaskedTemplate<RADIUS, 1> depthTarget;
+    start = cv::getTickCount();
+    for (int i = 0; i < steps; ++i) {
+        colorTarget.set(getPatch(planeColor, ps[i]), tmplateMask);
+        depthTarget.set(getPatch(planeDepth, ps[i]), tmplateMask);
+        sink += maskedSSD(colorTarget, planeColor.ptr<float>(qs[i].y - RADIUS) + 3 * (qs[i].x - RADIUS), planeColor.step1());
+        sink += maskedSSD(depthTarget, planeDepth.ptr<float>(qs[i].y - RADIUS) + (qs[i].x - RADIUS), planeDepth.step1());
+        getPatch(planeColor, qs[i]).copyTo(getPatch(planeColor, ps[i]), copyMask);
+        getPatch(planeDepth, qs[i]).copyTo(getPatch(planeDepth, ps[i]), copyMask);
+        getPatch(planeGray, qs[i]).copyTo(getPatch(planeGray, ps[i]), copyMask);
+    }
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    double bytes = patchArea * (4 * (planeColor.elemSize() + planeDepth.elemSize()) + 2 * planeGray.elemSize());
+    cout << "separate color and depth: " << seconds * 1e6 / steps << " us/step, " << bytes << " bytes/step, "
+         << bytes * steps / seconds / 1e9 << " GB/s" << endl;
+
+    // working image: one distance pass and one copy for color and depth, plus gray
+    MaskedTemplate<RADIUS, 4> layoutTarget;
+    start = cv::getTickCount();
+    for (int i = 0; i < steps; ++i) {
+        layoutTarget.set(getPatch(work, ps[i]), tmplateMask);
+        sink += maskedSSD(layoutTarget, work.ptr<float>(qs[i].y - RADIUS) + 4 * (qs[i].x - RADIUS), work.step1());
+        getPatch(work, qs[i]).copyTo(getPatch(work, ps[i]), copyMask);
+        getPatch(workGray, qs[i]).copyTo(getPatch(workGray, ps[i]), copyMask);
+    }
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    bytes = patchArea * (4 * work.elemSize() + 2 * workGray.elemSize());
+    cout << "working image: " << seconds * 1e6 / steps << " us/step, " << bytes << " bytes/step, "
+         << bytes * steps / seconds / 1e9 << " GB/s" << endl;
+
+    // color only working image, plus gray
+    start = cv::getTickCount();
+    for (int i = 0; i < steps; ++i) {
+        colorTarget.set(getPatch(workColor, ps[i]), tmplateMask);
+        sink += maskedSSD(colorTarget, workColor.ptr<float>(qs[i].y - RADIUS) + 3 * (qs[i].x - RADIUS), workColor.step1());
+        getPatch(workColor, qs[i]).copyTo(getPatch(workColor, ps[i]), copyMask);
+        getPatch(workGray, qs[i]).copyTo(getPatch(workGray, ps[i]), copyMask);
+    }
+    seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    bytes = patchArea * (4 * workColor.elemSize() + 2 * workGray.elemSize());
+    cout << "color working image: " << seconds * 1e6 / steps << " us/step, " << bytes << " bytes/step, "
+         << bytes * steps / seconds / 1e9 << " GB/s (" << sink << ")" << endl;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,391 @@
+#include "multigrid.h"
+
+// matrix-free multigrid preconditioned CG for reconstruct()
+
+// grids with at most this many unknowns are solved directly
+static const int COARSEST_UNKNOWNS = 256;
+// Gauss-Seidel sweeps before and after the coarse grid correction
+static const int SMOOTHING_STEPS = 2;
+// piecewise constant prolongation underestimates smooth errors, over-correcting
+// keeps the iteration count nearly independent of the hole size
+static const double CORRECTION_SCALE = 1.8;
+
+
+void PoissonMultigrid::setup(const cv::Mat& fillRegion)
+{
+    assert(fillRegion.type() == CV_8UC1);
+
+    fillRegion_ = fillRegion;
+    levels_.clear();
+
+    // bounding box of the fill region
+    int x0 = fillRegion.cols, y0 = fillRegion.rows, x1 = -1, y1 = -1;
+    for (int i = 0; i < fillRegion.rows; ++i)
+    {
+        const uchar* fillRow = fillRegion.ptr<uchar>(i);
+        for (int j = 0; j < fillRegion.cols; ++j)
+        {
+            if (fillRow[j] == 0)
+                continue;
+            x0 = std::min(x0, j);
+            x1 = std::max(x1, j);
+            y0 = std::min(y0, i);
+            y1 = std::max(y1, i);
+        }
+    }
+    if (x1 < 0)
+        return;
+    bbox_ = cv::Rect(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+
+    // finest grid: the 5-point stencil with the sign flipped to make it
+    // positive definite, known neighbours only add to the center
+    levels_.push_back(Level());
+    Level& fine = levels_.back();
+    initLevel(fine, bbox_.width, bbox_.height);
+
+    int N = 0;
+    for (int y = 0; y < fine.H; ++y)
+    {
+        const int i = bbox_.y + y;
+        const uchar* fillRow = fillRegion.ptr<uchar>(i);
+        const uchar* fillRowBelow = i + 1 < fillRegion.rows ? fillRegion.ptr<uchar>(i + 1) : NULL;
+        for (int x = 0; x < fine.W; ++x)
+        {
+            const int j = bbox_.x + x;
+            if (fillRow[j] == 0)
+                continue;
+
+            const int c = fine.index(x, y);
+            fine.unknown[c] = 1;
+            fine.diag[c] = (i >= 1) + (i <= fillRegion.rows - 2) + (j >= 1) + (j <= fillRegion.cols - 2);
+            if (x + 1 < fine.W && fillRow[j + 1] != 0)
+                fine.wx[c] = 1.0;
+            if (y + 1 < fine.H && fillRowBelow[j] != 0)
+                fine.wy[c] = 1.0;
+            ++N;
+        }
+    }
+
+    // coarsen until the direct solve is cheap
+    while (N > COARSEST_UNKNOWNS && (levels_.back().W > 1 || levels_.back().H > 1))
+    {
+        levels_.push_back(Level());
+        Level& coarse = levels_.back();
+        coarsen(levels_[levels_.size() - 2], coarse);
+        N = 0;
+        for (size_t c = 0; c < coarse.unknown.size(); ++c)
+            N += coarse.unknown[c];
+    }
+
+    factorCoarsest();
+}
+
+
+int PoissonMultigrid::solve(const cv::Mat& depth, const cv::Mat& laplacian, cv::Mat& filledDepth,
+                            double tolerance, int maxIterations, double* residual)
+{
+    assert(depth.type() == CV_32FC1 && laplacian.type() == CV_32FC1 && filledDepth.type() == CV_32FC1);
+    assert(depth.size() == fillRegion_.size() && filledDepth.size() == fillRegion_.size());
+
+    if (residual)
+        *residual = 0.0;
+    if (empty())
+        return 0;
+
+    const Level& fine = levels_[0];
+    const int H = fillRegion_.rows;
+    const int W = fillRegion_.cols;
+    const size_t n = fine.unknown.size();
+
+    // right hand side and initial guess
+    std::vector<double> b(n, 0.0), x(n, 0.0);
+    for (int y = 0; y < fine.H; ++y)
+    {
+        const int i = bbox_.y + y;
+        for (int xx = 0; xx < fine.W; ++xx)
+        {
+            const int j = bbox_.x + xx;
+            const int c = fine.index(xx, y);
+            if (!fine.unknown[c])
+                continue;
+
+            double v = -laplacian.ptr<float>(i)[j];
+            if (i >= 1 && fillRegion_.ptr<uchar>(i-1)[j] == 0)
+                v += depth.ptr<float>(i-1)[j];
+            if (i <= H - 2 && fillRegion_.ptr<uchar>(i+1)[j] == 0)
+                v += depth.ptr<float>(i+1)[j];
+            if (j >= 1 && fillRegion_.ptr<uchar>(i)[j-1] == 0)
+                v += depth.ptr<float>(i)[j-1];
+            if (j <= W - 2 && fillRegion_.ptr<uchar>(i)[j+1] == 0)
+                v += depth.ptr<float>(i)[j+1];
+            b[c] = v;
+            x[c] = filledDepth.ptr<float>(i)[j];
+        }
+    }
+
+    double bnorm = 0.0;
+    for (size_t c = 0; c < n; ++c)
+        bnorm += b[c] * b[c];
+    bnorm = std::sqrt(bnorm);
+    if (bnorm == 0.0)
+        bnorm = 1.0;
+
+    // preconditioned conjugate gradients with one V-cycle per iteration
+    std::vector<double> r(n), z(n), p(n), q(n);
+    apply(fine, x, q);
+    for (size_t c = 0; c < n; ++c)
+        r[c] = b[c] - q[c];
+
+    Level& top = levels_[0];
+    double rnorm = 0.0;
+    for (size_t c = 0; c < n; ++c)
+        rnorm += r[c] * r[c];
+    double relative = std::sqrt(rnorm) / bnorm;
+
+    int iteration = 0;
+    double rz = 0.0;
+    while (relative > tolerance && iteration < maxIterations)
+    {
+        top.b = r;
+        vcycle(0);
+        z = top.x;
+
+        double rzNew = 0.0;
+        for (size_t c = 0; c < n; ++c)
+            rzNew += r[c] * z[c];
+
+        if (iteration == 0)
+        {
+            p = z;
+        } else
+        {
+            const double beta = rzNew / rz;
+            for (size_t c = 0; c < n; ++c)
+                p[c] = z[c] + beta * p[c];
+        }
+        rz = rzNew;
+
+        apply(fine, p, q);
+        double pq = 0.0;
+        for (size_t c = 0; c < n; ++c)
+            pq += p[c] * q[c];
+        const double alpha = rz / pq;
+
+        rnorm = 0.0;
+        for (size_t c = 0; c < n; ++c)
+        {
+            x[c] += alpha * p[c];
+            r[c] -= alpha * q[c];
+            rnorm += r[c] * r[c];
+        }
+        relative = std::sqrt(rnorm) / bnorm;
+        ++iteration;
+    }
+
+    // filling depth
+    for (int y = 0; y < fine.H; ++y)
+    {
+        float* filledRow = filledDepth.ptr<float>(bbox_.y + y) + bbox_.x;
+        for (int xx = 0; xx < fine.W; ++xx)
+        {
+            const int c = fine.index(xx, y);
+            if (fine.unknown[c])
+                filledRow[xx] = (float) x[c];
+        }
+    }
+
+    if (residual)
+        *residual = relative;
+    return iteration;
+}
+
+
+void PoissonMultigrid::initLevel(Level& level, int W, int H)
+{
+    const size_t n = (size_t) (W + 2) * (H + 2);
+    level.W = W;
+    level.H = H;
+    level.unknown.assign(n, 0);
+    level.diag.assign(n, 0.0);
+    level.wx.assign(n, 0.0);
+    level.wy.assign(n, 0.0);
+    level.parent.assign(n, -1);
+    level.x.assign(n, 0.0);
+    level.b.assign(n, 0.0);
+    level.r.assign(n, 0.0);
+}
+
+
+/*
+ * Aggregate 2x2 blocks. With piecewise constant prolongation P the Galerkin
+ * operator P^T A P sums the centers of a block, subtracts twice the edges
+ * inside it and adds up the edges that cross to a neighbouring block.
+ */
+void PoissonMultigrid::coarsen(Level& fine, Level& coarse)
+{
+    initLevel(coarse, (fine.W + 1) / 2, (fine.H + 1) / 2);
+
+    for (int y = 0; y < fine.H; ++y)
+    {
+        for (int x = 0; x < fine.W; ++x)
+        {
+            const int c = fine.index(x, y);
+            if (!fine.unknown[c])
+                continue;
+
+            const int p = coarse.index(x / 2, y / 2);
+            fine.parent[c] = p;
+            coarse.unknown[p] = 1;
+            coarse.diag[p] += fine.diag[c];
+
+            if (fine.wx[c] != 0.0)
+            {
+                if ((x + 1) / 2 == x / 2)
+                    coarse.diag[p] -= 2.0 * fine.wx[c];
+                else
+                    coarse.wx[p] += fine.wx[c];
+            }
+            if (fine.wy[c] != 0.0)
+            {
+                if ((y + 1) / 2 == y / 2)
+                    coarse.diag[p] -= 2.0 * fine.wy[c];
+                else
+                    coarse.wy[p] += fine.wy[c];
+            }
+        }
+    }
+}
+
+
+void PoissonMultigrid::factorCoarsest()
+{
+    const Level& level = levels_.back();
+
+    coarsestCells_.clear();
+    std::vector<int> lut(level.unknown.size(), -1);
+    for (size_t c = 0; c < level.unknown.size(); ++c)
+    {
+        if (level.unknown[c])
+        {
+            lut[c] = (int) coarsestCells_.size();
+            coarsestCells_.push_back((int) c);
+        }
+    }
+
+    const int n = (int) coarsestCells_.size();
+    const int stride = level.W + 2;
+    Eigen::MatrixXd A = Eigen::MatrixXd::Zero(n, n);
+    for (int k = 0; k < n; ++k)
+    {
+        const int c = coarsestCells_[k];
+        A(k, k) = level.diag[c];
+        if (level.wx[c] != 0.0)
+        {
+            A(k, lut[c + 1]) = -level.wx[c];
+            A(lut[c + 1], k) = -level.wx[c];
+        }
+        if (level.wy[c] != 0.0)
+        {
+            A(k, lut[c + stride]) = -level.wy[c];
+            A(lut[c + stride], k) = -level.wy[c];
+        }
+    }
+    coarsest_.compute(A);
+}
+
+
+void PoissonMultigrid::apply(const Level& level, const std::vector<double>& x, std::vector<double>& out) const
+{
+    const int stride = level.W + 2;
+    out.assign(x.size(), 0.0);
+    for (int y = 0; y < level.H; ++y)
+    {
+        for (int c = level.index(0, y); c < level.index(level.W, y); ++c)
+        {
+            if (!level.unknown[c])
+                continue;
+            out[c] = level.diag[c] * x[c]
+                   - level.wx[c - 1] * x[c - 1] - level.wx[c] * x[c + 1]
+                   - level.wy[c - stride] * x[c - stride] - level.wy[c] * x[c + stride];
+        }
+    }
+}
+
+
+/*
+ * One Gauss-Seidel sweep over the cells of one color of the checkerboard.
+ */
+void PoissonMultigrid::smooth(Level& level, int color)
+{
+    const int stride = level.W + 2;
+    std::vector<double>& x = level.x;
+    for (int y = 0; y < level.H; ++y)
+    {
+        for (int xx = (y + color) & 1; xx < level.W; xx += 2)
+        {
+            const int c = level.index(xx, y);
+            if (!level.unknown[c])
+                continue;
+            x[c] = (level.b[c]
+                    + level.wx[c - 1] * x[c - 1] + level.wx[c] * x[c + 1]
+                    + level.wy[c - stride] * x[c - stride] + level.wy[c] * x[c + stride])
+                   / level.diag[c];
+        }
+    }
+}
+
+
+/*
+ * Approximately solve A x = b on level l starting from x = 0. The
+ * smoothing after the correction runs the colors in reverse order, so the
+ * cycle is a symmetric preconditioner.
+ */
+void PoissonMultigrid::vcycle(int l)
+{
+    Level& level = levels_[l];
+
+    if (l == (int) levels_.size() - 1)
+    {
+        const int n = (int) coarsestCells_.size();
+        Eigen::VectorXd b(n);
+        for (int k = 0; k < n; ++k)
+            b[k] = level.b[coarsestCells_[k]];
+        Eigen::VectorXd x = coarsest_.solve(b);
+        std::fill(level.x.begin(), level.x.end(), 0.0);
+        for (int k = 0; k < n; ++k)
+            level.x[coarsestCells_[k]] = x[k];
+        return;
+    }
+
+    std::fill(level.x.begin(), level.x.end(), 0.0);
+    for (int k = 0; k < SMOOTHING_STEPS; ++k)
+    {
+        smooth(level, 0);
+        smooth(level, 1);
+    }
+
+    // restrict the residual
+    apply(level, level.x, level.r);
+    Level& coarse = levels_[l + 1];
+    std::fill(coarse.b.begin(), coarse.b.end(), 0.0);
+    for (size_t c = 0; c < level.unknown.size(); ++c)
+    {
+        if (level.unknown[c])
+            coarse.b[level.parent[c]] += level.b[c] - level.r[c];
+    }
+
+    vcycle(l + 1);
+
+    // prolongate the correction
+    for (size_t c = 0; c < level.unknown.size(); ++c)
+    {
+        if (level.unknown[c])
+            level.x[c] += CORRECTION_SCALE * coarse.x[level.parent[c]];
+    }
+
+    for (int k = 0; k < SMOOTHING_STEPS; ++k)
+    {
+        smooth(level, 1);
+        smooth(level, 0);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef MULTIGRID_H
+#define MULTIGRID_H
+
+#include "utils.h"
+#include <Eigen/Dense>
+
+/*
+ * Matrix-free multigrid for the Poisson system of reconstruct(). The
+ * 5-point stencil of the fill region is stored on the image grid of the
+ * hole's bounding box. Coarser grids aggregate 2x2 blocks and take the
+ * Galerkin product of the finer stencil, which stays a 5-point stencil and
+ * follows the shape of the mask. A symmetric V-cycle preconditions
+ * conjugate gradients on the finest grid, so the cost is linear in the
+ * number of unknowns.
+ */
+class PoissonMultigrid
+{
+public:
+    // build the grid hierarchy for the pixels where fillRegion != 0
+    void setup(const cv::Mat& fillRegion);
+
+    // solve for the fill region of filledDepth, whose current values there
+    // are the initial guess. Returns the number of iterations; residual
+    // receives the final ||b - Ax|| / ||b||.
+    int solve(const cv::Mat& depth, const cv::Mat& laplacian, cv::Mat& filledDepth,
+              double tolerance, int maxIterations, double* residual = NULL);
+
+    bool empty() const { return levels_.empty(); }
+
+private:
+    struct Level
+    {
+        int W, H;                       // grid size, the arrays have a one cell zero border
+        std::vector<uchar> unknown;
+        std::vector<double> diag;       // stencil center
+        std::vector<double> wx, wy;     // weights of the edges to the east and south neighbours
+        std::vector<int> parent;        // cell of the coarser grid this cell belongs to
+        std::vector<double> x, b, r;
+        int index(int x, int y) const { return (y + 1) * (W + 2) + x + 1; }
+    };
+
+    void initLevel(Level& level, int W, int H);
+    void coarsen(Level& fine, Level& coarse);
+    void factorCoarsest();
+    void apply(const Level& level, const std::vector<double>& x, std::vector<double>& out) const;
+    void smooth(Level& level, int color);
+    void vcycle(int l);
+
+    cv::Mat fillRegion_;
+    cv::Rect bbox_;                     // bounding box of the fill region
+    std::vector<Level> levels_;
+    std::vector<int> coarsestCells_;    // unknown cells of the coarsest grid
+    Eigen::LDLT<Eigen::MatrixXd> coarsest_;
+};
+
+#endif
@@ -0,0 +1,569 @@
+#include "patchsearch.h"
+
+#include <cfloat>
+#include <cmath>
+
+// exemplar search strategies for psiHatQ
+
+
+#ifndef NDEBUG
+/*
+ * True when the fourth channel is within [0, 1] on the source region, as a
+ * session leaves it after normalizeDepth.
+ */
+static bool isNormalizedDepth(const cv::Mat& colorMat, const cv::Mat& maskMat)
+{
+    cv::Mat depth;
+    double lo = 0.0, hi = 0.0;
+    cv::extractChannel(colorMat, depth, 3);
+    cv::minMaxLoc(depth, &lo, &hi, NULL, NULL, maskMat);
+    return lo >= 0.0 && hi <= 1.0 + 1e-6;
+}
+#endif
+
+
+void PatchSearch::init(const SearchParams& params, const cv::Mat& colorMat, const cv::Mat& maskMat, const cv::Mat& erodedMask,
+                       const cv::Mat& priorOffsets)
+{
+    assert((colorMat.type() == CV_32FC3 || colorMat.type() == CV_32FC4) && maskMat.type() == CV_8UC1 &&
+           erodedMask.type() == CV_8UC1);
+    assert(colorMat.size() == maskMat.size() && colorMat.size() == erodedMask.size());
+
+    assert(params.radius >= 1);
+    params_ = params;
+    radius_ = params.radius;
+    erodedMask_ = erodedMask;
+
+    // a fourth channel is depth, scaled so its squared difference counts depthWeight times
+    assert(params.depthWeight >= 0);
+    channelWeights_[0] = channelWeights_[1] = channelWeights_[2] = 1.0f;
+    channelWeights_[3] = std::sqrt(params.depthWeight);
+
+    if (params_.quantized)
+    {
+        // one scale for all channels keeps their weights. Color and depth are
+        // in [0, 1], so only a depth weight above 1 shrinks it below 255
+        assert(colorMat.channels() == 3 || isNormalizedDepth(colorMat, maskMat));
+        quantScale_ = 255.0 / std::max(1.0f, channelWeights_[3]);
+
+        quantMat_.create(colorMat.size(), CV_8UC(colorMat.channels()));
+        quantize(cv::Rect(0, 0, colorMat.cols, colorMat.rows), colorMat);
+    } else
+    {
+        quantMat_.release();
+    }
+
+    // list the valid psiHatQ once, the searches only visit these
+    sources_.clear();
+    rowStart_.assign(erodedMask.rows + 1, 0);
+    for (int y = 0; y < erodedMask.rows; ++y)
+    {
+        rowStart_[y] = (int) sources_.size();
+        if (y < radius_ || y >= erodedMask.rows - radius_)
+            continue;
+
+        const uchar* erodedRow = erodedMask.ptr<uchar>(y);
+        for (int x = radius_; x < erodedMask.cols - radius_; ++x)
+        {
+            if (erodedRow[x] != 0)
+            {
+                sources_.push_back(y * erodedMask.cols + x);
+            }
+        }
+    }
+    rowStart_[erodedMask.rows] = (int) sources_.size();
+
+    if (params_.strategy == SEARCH_PATCHMATCH)
+    {
+        assert(params_.iterations >= 1);
+        offsets_.create(colorMat.size(), CV_32SC2);
+        offsets_.setTo(cv::Scalar::all(0));
+        priorOffsets_.release();
+        if (!priorOffsets.empty())
+        {
+            assert(priorOffsets.type() == CV_32SC2 && priorOffsets.size() == colorMat.size());
+            priorOffsets_ = priorOffsets;
+        }
+        rng_ = cv::RNG(0x1234567);
+        return;
+    }
+
+    if (params_.strategy != SEARCH_PYRAMID)
+        return;
+
+    assert(params_.levels >= 1 && params_.candidates >= 1);
+
+    int s = 1 << params_.levels;
+    cv::Size coarseSize(colorMat.cols / s, colorMat.rows / s);
+    coarseColor_.create(coarseSize, colorMat.type());
+    coarseKnown_.create(coarseSize, CV_32FC1);
+    coarseValid_.create(coarseSize, CV_8UC1);
+
+    // a block stands for the patch centered at its middle pixel
+    for (int y = 0; y < coarseSize.height; ++y)
+    {
+        const uchar* erodedRow = erodedMask.ptr<uchar>(y*s + s/2);
+        uchar* validRow = coarseValid_.ptr<uchar>(y);
+        for (int x = 0; x < coarseSize.width; ++x)
+        {
+            validRow[x] = erodedRow[x*s + s/2];
+        }
+    }
+
+    downsample(cv::Rect(0, 0, coarseSize.width * s, coarseSize.height * s), colorMat, maskMat);
+}
+
+
+bool PatchSearch::find(const cv::Point& psiHatP, const cv::Mat& colorMat, const cv::Mat& tmplateMask,
+                       cv::Point& psiHatQ) const
+{
+    assert(colorMat.size() == erodedMask_.size());
+    assert(tmplateMask.type() == CV_8UC1 && tmplateMask.rows == 2*radius_ + 1 && tmplateMask.cols == 2*radius_ + 1);
+
+    cv::Mat tmplate = getPatch(colorMat, psiHatP, radius_);
+    if (params_.strategy == SEARCH_EXHAUSTIVE)
+        return findExhaustive(tmplate, colorMat, tmplateMask, psiHatQ);
+
+    // the approximate searches run on kernels unrolled for the common radii
+    bool found = false;
+    switch (radius_)
+    {
+        case 3: found = findApproximate<3>(psiHatP, tmplate, colorMat, tmplateMask, psiHatQ); break;
+        case 4: found = findApproximate<4>(psiHatP, tmplate, colorMat, tmplateMask, psiHatQ); break;
+        case 5: found = findApproximate<5>(psiHatP, tmplate, colorMat, tmplateMask, psiHatQ); break;
+        case 7: found = findApproximate<7>(psiHatP, tmplate, colorMat, tmplateMask, psiHatQ); break;
+        case 9: found = findApproximate<9>(psiHatP, tmplate, colorMat, tmplateMask, psiHatQ); break;
+        default: break;
+    }
+    if (found)
+        return true;
+
+    return findExhaustive(tmplate, colorMat, tmplateMask, psiHatQ);
+}
+
+
+template<int R>
+bool PatchSearch::findApproximate(const cv::Point& psiHatP, const cv::Mat& tmplate, const cv::Mat& colorMat,
+                                  const cv::Mat& tmplateMask, cv::Point& psiHatQ) const
+{
+    if (params_.quantized && quantMat_.channels() == 4)
+    {
+        QuantizedTemplate<R, 4> target;
+        target.set(getPatch(quantMat_, psiHatP, R), tmplateMask);
+        return findTemplate(psiHatP, target, quantMat_, psiHatQ);
+    } else if (params_.quantized)
+    {
+        QuantizedTemplate<R, 3> target;
+        target.set(getPatch(quantMat_, psiHatP, R), tmplateMask);
+        return findTemplate(psiHatP, target, quantMat_, psiHatQ);
+    }
+
+    if (colorMat.channels() == 4)
+    {
+        MaskedTemplate<R, 4> target;
+        target.set(tmplate, tmplateMask, channelWeights_);
+        return findTemplate(psiHatP, target, colorMat, psiHatQ);
+    }
+
+    MaskedTemplate<R, 3> target;
+    target.set(tmplate, tmplateMask);
+    return findTemplate(psiHatP, target, colorMat, psiHatQ);
+}
+
+
+template<class T>
+bool PatchSearch::findTemplate(const cv::Point& psiHatP, const T& target, const cv::Mat& colorMat,
+                               cv::Point& psiHatQ) const
+{
+    float bestDistance = FLT_MAX;
+
+    if (params_.strategy == SEARCH_WINDOW)
+    {
+        int w = params_.windowRadius;
+        cv::Rect centers(psiHatP.x - w, psiHatP.y - w, 2*w + 1, 2*w + 1);
+        return findInWindow(centers, target, colorMat, bestDistance, psiHatQ);
+    } else if (params_.strategy == SEARCH_PYRAMID)
+    {
+        return findPyramid(psiHatP, target, colorMat, psiHatQ);
+    } else if (params_.strategy == SEARCH_PATCHMATCH)
+    {
+        return findPatchMatch(psiHatP, target, colorMat, psiHatQ);
+    }
+    return false;
+}
+
+
+/*
+ * Only blocks overlapping the filled patch change. Pixels of the patch that
+ * have no offset yet remember psiHatQ - psiHatP, so later targets that
+ * overlap them can propagate it.
+ */
+void PatchSearch::update(const cv::Point& psiHatP, const cv::Point& psiHatQ, const cv::Mat& colorMat, const cv::Mat& maskMat)
+{
+    cv::Rect patch(psiHatP.x - radius_, psiHatP.y - radius_, 2*radius_ + 1, 2*radius_ + 1);
+
+    if (params_.quantized)
+    {
+        quantize(patch, colorMat);
+    }
+
+    if (params_.strategy == SEARCH_PYRAMID)
+    {
+        downsample(patch, colorMat, maskMat);
+    } else if (params_.strategy == SEARCH_PATCHMATCH)
+    {
+        const cv::Vec2i offset(psiHatQ.x - psiHatP.x, psiHatQ.y - psiHatP.y);
+        for (int y = patch.y; y < patch.y + patch.height; ++y)
+        {
+            cv::Vec2i* offsetRow = offsets_.ptr<cv::Vec2i>(y);
+            for (int x = patch.x; x < patch.x + patch.width; ++x)
+            {
+                if (offsetRow[x] == cv::Vec2i(0, 0))
+                {
+                    offsetRow[x] = offset;
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ * The reference search: masked SSD against every valid psiHatQ, visited in
+ * raster order from the source index so no target pixel is read. Works for
+ * any radius; rows are summed densest first and a candidate stops as soon
+ * as it reaches the best distance, which keeps the first minimum in raster
+ * order.
+ */
+bool PatchSearch::findExhaustive(const cv::Mat& tmplate, const cv::Mat& colorMat, const cv::Mat& tmplateMask,
+                                 cv::Point& psiHatQ) const
+{
+    assert(colorMat.depth() == CV_32F && tmplate.type() == colorMat.type());
+    if (sources_.empty())
+        return false;
+
+    const int size = tmplate.rows;
+    const int cn = colorMat.channels();
+    const int row = cn * size;
+
+    std::vector<float> values(size * row), weights(size * row);
+    std::vector<int> known(size, 0), order;
+    for (int y = 0; y < size; ++y)
+    {
+        const float* tmplateRow = tmplate.ptr<float>(y);
+        const uchar* maskRow = tmplateMask.ptr<uchar>(y);
+        for (int i = 0; i < row; ++i)
+        {
+            float valid = maskRow[i / cn] != 0 ? 1.0f : 0.0f;
+            weights[y * row + i] = valid * channelWeights_[i % cn];
+            values[y * row + i] = tmplateRow[i] * valid;
+        }
+        for (int x = 0; x < size; ++x)
+        {
+            known[y] += maskRow[x] != 0;
+        }
+        if (known[y] != 0)
+        {
+            order.push_back(y);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&known](int a, int b) { return known[a] > known[b]; });
+
+    const int radius = size / 2;
+    const size_t step = colorMat.step1();
+    float bestDistance = FLT_MAX;
+    int best = -1;
+    for (size_t k = 0; k < sources_.size(); ++k)
+    {
+        const int x = sources_[k] % colorMat.cols;
+        const int y = sources_[k] / colorMat.cols;
+        const float* source = colorMat.ptr<float>(y - radius) + cn * (x - radius);
+
+        float distance = 0.0f;
+        for (size_t j = 0; j < order.size() && distance < bestDistance; ++j)
+        {
+            const int r = order[j];
+            distance += maskedRowSSD(&values[r * row], &weights[r * row], source + r * step, row);
+        }
+        if (distance < bestDistance)
+        {
+            bestDistance = distance;
+            best = sources_[k];
+        }
+    }
+
+    psiHatQ = cv::Point(best % colorMat.cols, best / colorMat.cols);
+    return true;
+}
+
+
+/*
+ * Match the downsampled template against the coarse image, then refine the
+ * best few coarse matches with an exact search over the fine pixels of
+ * their block and its neighbours.
+ */
+template<class T>
+bool PatchSearch::findPyramid(const cv::Point& psiHatP, const T& target, const cv::Mat& colorMat,
+                              cv::Point& psiHatQ) const
+{
+    const int R = T::SIZE / 2;
+    int s = 1 << params_.levels;
+    int rc = std::max(1, R >> params_.levels);
+
+    cv::Point c(psiHatP.x / s, psiHatP.y / s);
+    cv::Rect cells(c.x - rc, c.y - rc, 2*rc + 1, 2*rc + 1);
+    if ((cells & cv::Rect(0, 0, coarseColor_.cols, coarseColor_.rows)) != cells)
+        return false;
+
+    // blocks that still contain target pixels are left out of the template
+    cv::Mat known = (coarseKnown_(cells) > 0.999f);
+    if (cv::countNonZero(known) == 0)
+        return false;
+
+    known.convertTo(known, CV_32F, 1.0 / 255.0);
+    cv::Mat coarseMask;
+    std::vector<cv::Mat> mergeArrays(coarseColor_.channels());
+    for (int c = 0; c < coarseColor_.channels(); ++c)
+        mergeArrays[c] = known * channelWeights_[c];
+    cv::merge(mergeArrays, coarseMask);
+
+    cv::Mat result;
+    cv::matchTemplate(coarseColor_, coarseColor_(cells), result, CV_TM_SQDIFF, coarseMask);
+
+    cv::Mat candidates = coarseValid_(cv::Rect(rc, rc, result.cols, result.rows)).clone();
+
+    float bestDistance = FLT_MAX;
+    bool found = false;
+    for (int k = 0; k < params_.candidates; ++k)
+    {
+        cv::Point minLoc(-1, -1);
+        cv::minMaxLoc(result, NULL, NULL, &minLoc, NULL, candidates);
+        if (minLoc.x < 0)
+            break;
+
+        // the neighbouring blocks are covered by the same refinement window
+        cv::rectangle(candidates, minLoc - cv::Point(1, 1), minLoc + cv::Point(1, 1), cv::Scalar(0), cv::FILLED);
+
+        cv::Point center((minLoc.x + rc) * s + s/2, (minLoc.y + rc) * s + s/2);
+        cv::Rect window(center.x - s, center.y - s, 2*s + 1, 2*s + 1);
+        found |= findInWindow(window, target, colorMat, bestDistance, psiHatQ);
+    }
+
+    return found;
+}
+
+
+/*
+ * Randomized nearest neighbour search in the spirit of PatchMatch. The
+ * offsets that filled the pixels of the target patch are tried first
+ * (propagation), then every iteration tests the four one pixel shifts of
+ * the best match and random samples around it with a halving radius.
+ */
+template<class T>
+bool PatchSearch::findPatchMatch(const cv::Point& psiHatP, const T& target, const cv::Mat& colorMat,
+                                 cv::Point& psiHatQ) const
+{
+    const int R = T::SIZE / 2;
+    float bestDistance = FLT_MAX;
+    bool found = false;
+
+    // propagation: the distinct offsets recorded around psiHatP, in this run
+    // and in the prior one
+    std::vector<cv::Vec2i> seeds;
+    for (int y = psiHatP.y - R; y <= psiHatP.y + R; ++y)
+    {
+        const cv::Vec2i* offsetRow = offsets_.ptr<cv::Vec2i>(y);
+        const cv::Vec2i* priorRow = priorOffsets_.empty() ? NULL : priorOffsets_.ptr<cv::Vec2i>(y);
+        for (int x = psiHatP.x - R; x <= psiHatP.x + R; ++x)
+        {
+            const cv::Vec2i& offset = offsetRow[x];
+            if (offset != cv::Vec2i(0, 0) && std::find(seeds.begin(), seeds.end(), offset) == seeds.end())
+            {
+                seeds.push_back(offset);
+            }
+            if (priorRow && priorRow[x] != cv::Vec2i(0, 0) &&
+                std::find(seeds.begin(), seeds.end(), priorRow[x]) == seeds.end())
+            {
+                seeds.push_back(priorRow[x]);
+            }
+        }
+    }
+    for (int i = 0; i < (int) seeds.size(); ++i)
+    {
+        found |= tryCandidate(psiHatP + cv::Point(seeds[i][0], seeds[i][1]), target, colorMat, bestDistance, psiHatQ);
+    }
+
+    // no usable neighbour, start from random source patches
+    const int maxRadius = params_.searchRadius > 0 ? params_.searchRadius : std::max(colorMat.rows, colorMat.cols);
+    for (int tries = 0; !found && tries < 64; ++tries)
+    {
+        cv::Point q;
+        if (params_.searchRadius > 0)
+        {
+            q = psiHatP + cv::Point(rng_.uniform(-maxRadius, maxRadius + 1), rng_.uniform(-maxRadius, maxRadius + 1));
+        } else if (!sources_.empty())
+        {
+            int source = sources_[rng_.uniform(0, (int) sources_.size())];
+            q = cv::Point(source % colorMat.cols, source / colorMat.cols);
+        }
+        found |= tryCandidate(q, target, colorMat, bestDistance, psiHatQ);
+    }
+    if (!found)
+        return false;
+
+    for (int iteration = 0; iteration < params_.iterations; ++iteration)
+    {
+        // propagation: shifts of the current best match
+        const cv::Point best = psiHatQ;
+        tryCandidate(best + cv::Point(-1, 0), target, colorMat, bestDistance, psiHatQ);
+        tryCandidate(best + cv::Point(1, 0), target, colorMat, bestDistance, psiHatQ);
+        tryCandidate(best + cv::Point(0, -1), target, colorMat, bestDistance, psiHatQ);
+        tryCandidate(best + cv::Point(0, 1), target, colorMat, bestDistance, psiHatQ);
+
+        // random search around the best match
+        for (int r = maxRadius; r >= 1; r /= 2)
+        {
+            cv::Point q = psiHatQ + cv::Point(rng_.uniform(-r, r + 1), rng_.uniform(-r, r + 1));
+            tryCandidate(q, target, colorMat, bestDistance, psiHatQ);
+        }
+    }
+
+    return true;
+}
+
+
+/*
+ * Masked SSD of the patch centered at q if q is a valid psiHatQ.
+ */
+template<class T>
+bool PatchSearch::tryCandidate(const cv::Point& q, const T& target, const cv::Mat& colorMat,
+                               float& bestDistance, cv::Point& psiHatQ) const
+{
+    const int R = T::SIZE / 2;
+    if (q.x < R || q.x >= colorMat.cols - R || q.y < R || q.y >= colorMat.rows - R)
+        return false;
+    if (erodedMask_.ptr<uchar>(q.y)[q.x] == 0)
+        return false;
+
+    float distance = maskedSSD(target, colorMat.ptr<typename T::Value>(q.y - R) + T::CHANNELS * (q.x - R),
+                               colorMat.step1(), bestDistance);
+
+    if (distance >= bestDistance)
+        return false;
+
+    bestDistance = distance;
+    psiHatQ = q;
+    return true;
+}
+
+
+/*
+ * Exact masked SSD for every valid psiHatQ in centers. psiHatQ and
+ * bestDistance are only changed when a closer patch is found.
+ *
+ * Rows are visited outwards from the middle of centers, so a close match is
+ * usually found early and bounds the SSD of the rest. Equal distances go to
+ * the first candidate in raster order, which keeps the result identical to
+ * a raster scan without early termination.
+ */
+template<class T>
+bool PatchSearch::findInWindow(const cv::Rect& centers, const T& target, const cv::Mat& colorMat,
+                               float& bestDistance, cv::Point& psiHatQ) const
+{
+    cv::Rect valid = centers & cv::Rect(0, 0, colorMat.cols, colorMat.rows);
+    if (valid.area() == 0)
+        return false;
+
+    const int c = centers.y + centers.height / 2;
+    const int span = std::max(c - valid.y, valid.y + valid.height - 1 - c);
+
+    bool found = false;
+    for (int d = 0; d <= span; ++d)
+    {
+        if (c - d >= valid.y && c - d < valid.y + valid.height)
+            searchRow(c - d, valid.x, valid.x + valid.width - 1, target, colorMat, bestDistance, psiHatQ, found);
+        if (d > 0 && c + d >= valid.y && c + d < valid.y + valid.height)
+            searchRow(c + d, valid.x, valid.x + valid.width - 1, target, colorMat, bestDistance, psiHatQ, found);
+    }
+
+    return found;
+}
+
+
+/*
+ * Evaluate the valid psiHatQ of row y between x0 and x1, read in order from
+ * the source index.
+ */
+template<class T>
+void PatchSearch::searchRow(int y, int x0, int x1, const T& target, const cv::Mat& colorMat,
+                            float& bestDistance, cv::Point& psiHatQ, bool& found) const
+{
+    const int base = y * colorMat.cols;
+    const int* first = sources_.data() + rowStart_[y];
+    const int* last = sources_.data() + rowStart_[y + 1];
+    first = std::lower_bound(first, last, base + x0);
+    last = std::upper_bound(first, last, base + x1);
+    if (first == last)
+        return;
+
+    const size_t step = colorMat.step1();
+    const int R = T::SIZE / 2;
+    const typename T::Value* sourceRow = colorMat.ptr<typename T::Value>(y - R);
+    for (const int* source = first; source != last; ++source)
+    {
+        const int x = *source - base;
+        float distance = maskedSSD(target, sourceRow + T::CHANNELS * (x - R), step, bestDistance);
+        if (distance < bestDistance ||
+            (distance == bestDistance && (y < psiHatQ.y || (y == psiHatQ.y && x < psiHatQ.x))))
+        {
+            bestDistance = distance;
+            psiHatQ = cv::Point(x, y);
+            found = true;
+        }
+    }
+}
+
+
+/*
+ * Average the blocks of colorMat and maskMat covering fineRect into the
+ * coarse images.
+ */
+void PatchSearch::downsample(const cv::Rect& fineRect, const cv::Mat& colorMat, const cv::Mat& maskMat)
+{
+    int s = 1 << params_.levels;
+
+    int cx0 = fineRect.x / s;
+    int cy0 = fineRect.y / s;
+    int cx1 = std::min((fineRect.x + fineRect.width + s - 1) / s, coarseColor_.cols);
+    int cy1 = std::min((fineRect.y + fineRect.height + s - 1) / s, coarseColor_.rows);
+    if (cx1 <= cx0 || cy1 <= cy0)
+        return;
+
+    cv::Rect cells(cx0, cy0, cx1 - cx0, cy1 - cy0);
+    cv::Rect blocks(cx0 * s, cy0 * s, cells.width * s, cells.height * s);
+
+    cv::Mat color = coarseColor_(cells);
+    cv::resize(colorMat(blocks), color, cells.size(), 0, 0, cv::INTER_AREA);
+
+    cv::Mat fineKnown;
+    maskMat(blocks).convertTo(fineKnown, CV_32F, 1.0 / 255.0);
+    cv::Mat known = coarseKnown_(cells);
+    cv::resize(fineKnown, known, cells.size(), 0, 0, cv::INTER_AREA);
+}
+
+
+/*
+ * Scale rect of colorMat by quantScale_ and the channel weights into
+ * quantMat_, rounded to 8 bits. Source values do not saturate.
+ */
+void PatchSearch::quantize(const cv::Rect& rect, const cv::Mat& colorMat)
+{
+    cv::Scalar scale;
+    for (int c = 0; c < colorMat.channels(); ++c)
+        scale[c] = quantScale_ * channelWeights_[c];
+
+    cv::Mat scaled;
+    cv::multiply(colorMat(rect), scale, scaled);
+    cv::Mat quant = quantMat_(rect);
+    scaled.convertTo(quant, CV_8U);
+}
@@ -0,0 +1,110 @@
+#ifndef PATCHSEARCH_H
+#define PATCHSEARCH_H
+
+#include "utils.h"
+#include "ssd.h"
+
+enum SearchStrategy
+{
+    SEARCH_EXHAUSTIVE,      // masked SSD of every valid psiHatQ, reference quality
+    SEARCH_WINDOW,          // exact search in a window around the target patch
+    SEARCH_PYRAMID,         // coarse search on a downsampled image, refined at full resolution
+    SEARCH_PATCHMATCH       // approximate search seeded with the offsets of filled neighbours
+};
+
+struct SearchParams
+{
+    int radius;             // patch radius. 3, 4, 5, 7 and 9 have unrolled kernels, the approximate
+                            // strategies fall back to the exhaustive search for other radii
+    float depthWeight;      // weight of the squared depth difference against color, both in [0, 1].
+                            // A session maps its source depth range to [0, 1] (normalizeDepth).
+    bool quantized;         // approximate strategies compare patches on an 8 bit copy of the search
+                            // image, a quarter of its memory. Depth must be normalized to [0, 1] like
+                            // color (normalizeDepth, sessions do it), all channels share one scale.
+    SearchStrategy strategy;
+    int windowRadius;       // SEARCH_WINDOW: max distance of psiHatQ from psiHatP
+    int levels;             // SEARCH_PYRAMID: the coarse image is downsampled by 2^levels
+    int candidates;         // SEARCH_PYRAMID: number of coarse matches refined at full resolution
+    int iterations;         // SEARCH_PATCHMATCH: propagation and random search rounds
+    int searchRadius;       // SEARCH_PATCHMATCH: first random search radius, 0 for the image size
+
+    SearchParams()
+        : radius(RADIUS), depthWeight(1.0f), quantized(false), strategy(SEARCH_EXHAUSTIVE), windowRadius(60), levels(2), candidates(4),
+          iterations(4), searchRadius(0)
+    {}
+};
+
+/*
+ * Finds the source patch psiHatQ closest to the target patch psiHatP.
+ * Only centers of erodedMask, whose patches lie entirely in the source
+ * region, are considered. The window and pyramid strategies fall back to
+ * the exhaustive search when they find no valid candidate.
+ */
+class PatchSearch
+{
+public:
+    // colorMat     - CV_32FC3 color, or CV_32FC4 with depth as fourth channel, in [0, 1]
+    //                on the source region when params.quantized
+    // erodedMask   - maskMat eroded by params.radius, non zero for valid psiHatQ
+    // priorOffsets - SEARCH_PATCHMATCH: CV_32SC2 offsets of an earlier run on the same
+    //                geometry, e.g. the previous video frame, tried as extra seeds
+    void init(const SearchParams& params, const cv::Mat& colorMat, const cv::Mat& maskMat, const cv::Mat& erodedMask,
+              const cv::Mat& priorOffsets = cv::Mat());
+
+    // tmplateMask - CV_8UC1 patch around psiHatP, non zero for known pixels
+    // returns false when there is no valid psiHatQ at all
+    bool find(const cv::Point& psiHatP, const cv::Mat& colorMat, const cv::Mat& tmplateMask, cv::Point& psiHatQ) const;
+
+    // keep the downsampled images and the offsets in sync after the patch at
+    // psiHatP was filled from psiHatQ
+    void update(const cv::Point& psiHatP, const cv::Point& psiHatQ, const cv::Mat& colorMat, const cv::Mat& maskMat);
+
+    const SearchParams& params() const { return params_; }
+
+    // SEARCH_PATCHMATCH: psiHatQ - psiHatP of the patch that filled each pixel, (0, 0) if none
+    const cv::Mat& offsets() const { return offsets_; }
+
+private:
+    bool findExhaustive(const cv::Mat& tmplate, const cv::Mat& colorMat, const cv::Mat& tmplateMask,
+                        cv::Point& psiHatQ) const;
+    template<int R>
+    bool findApproximate(const cv::Point& psiHatP, const cv::Mat& tmplate, const cv::Mat& colorMat,
+                         const cv::Mat& tmplateMask, cv::Point& psiHatQ) const;
+    template<class T>
+    bool findTemplate(const cv::Point& psiHatP, const T& target, const cv::Mat& colorMat,
+                      cv::Point& psiHatQ) const;
+    template<class T>
+    bool findPyramid(const cv::Point& psiHatP, const T& target, const cv::Mat& colorMat,
+                     cv::Point& psiHatQ) const;
+    template<class T>
+    bool findPatchMatch(const cv::Point& psiHatP, const T& target, const cv::Mat& colorMat,
+                        cv::Point& psiHatQ) const;
+    template<class T>
+    bool tryCandidate(const cv::Point& q, const T& target, const cv::Mat& colorMat,
+                      float& bestDistance, cv::Point& psiHatQ) const;
+    template<class T>
+    bool findInWindow(const cv::Rect& centers, const T& target, const cv::Mat& colorMat,
+                      float& bestDistance, cv::Point& psiHatQ) const;
+    template<class T>
+    void searchRow(int y, int x0, int x1, const T& target, const cv::Mat& colorMat,
+                   float& bestDistance, cv::Point& psiHatQ, bool& found) const;
+    void downsample(const cv::Rect& fineRect, const cv::Mat& colorMat, const cv::Mat& maskMat);
+    void quantize(const cv::Rect& rect, const cv::Mat& colorMat);
+
+    SearchParams params_;
+    int radius_;
+    float channelWeights_[4];       // factor of each channel difference, the fourth is sqrt(depthWeight)
+    cv::Mat erodedMask_;
+    std::vector<int> sources_;      // raster index y*cols + x of every valid psiHatQ, ascending
+    std::vector<int> rowStart_;     // sources_ of row y are [rowStart_[y], rowStart_[y+1])
+    cv::Mat quantMat_;      // quantized: colorMat times quantScale_ and the channel weights, CV_8UC3 or CV_8UC4
+    double quantScale_;     // 255 divided by the larger of 1 and sqrt(depthWeight)
+    cv::Mat coarseColor_;   // colorMat averaged over 2^levels blocks
+    cv::Mat coarseKnown_;   // fraction of source pixels in each block
+    cv::Mat coarseValid_;   // non zero where the block center is a valid psiHatQ
+    cv::Mat offsets_;       // CV_32SC2, psiHatQ - psiHatP of the patch that filled each pixel
+    cv::Mat priorOffsets_;  // CV_32SC2 seeds of an earlier run, may be empty
+    mutable cv::RNG rng_;
+};
+
+#endif
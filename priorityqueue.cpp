@@ -0,0 +1,100 @@
+#include "priorityqueue.h"
+
+// indexed max-heap of fill front priorities
+
+
+void PriorityQueue::reset(const cv::Size& size)
+{
+    pos_.create(size, CV_32SC1);
+    pos_.setTo(-1);
+    heap_.clear();
+}
+
+
+void PriorityQueue::push(const cv::Point& p, float priority)
+{
+    int i = pos_.ptr<int>(p.y)[p.x];
+    if (i < 0)
+    {
+        Entry e;
+        e.priority = priority;
+        e.index = p.y * pos_.cols + p.x;
+        e.point = p;
+        heap_.push_back(e);
+        i = (int) heap_.size() - 1;
+        pos_.ptr<int>(p.y)[p.x] = i;
+        siftUp(i);
+        return;
+    }
+
+    float old = heap_[i].priority;
+    heap_[i].priority = priority;
+    if (priority > old)
+    {
+        siftUp(i);
+    } else
+    {
+        siftDown(i);
+    }
+}
+
+
+void PriorityQueue::erase(const cv::Point& p)
+{
+    int i = pos_.ptr<int>(p.y)[p.x];
+    if (i < 0)
+        return;
+
+    pos_.ptr<int>(p.y)[p.x] = -1;
+    Entry last = heap_.back();
+    heap_.pop_back();
+    if (i == (int) heap_.size())
+        return;
+
+    // move the last entry into the hole and restore the heap in either direction
+    place(i, last);
+    siftUp(i);
+    siftDown(pos_.ptr<int>(last.point.y)[last.point.x]);
+}
+
+
+void PriorityQueue::place(int i, const Entry& e)
+{
+    heap_[i] = e;
+    pos_.ptr<int>(e.point.y)[e.point.x] = i;
+}
+
+
+void PriorityQueue::siftUp(int i)
+{
+    Entry e = heap_[i];
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!before(e, heap_[parent]))
+            break;
+        place(i, heap_[parent]);
+        i = parent;
+    }
+    place(i, e);
+}
+
+
+void PriorityQueue::siftDown(int i)
+{
+    Entry e = heap_[i];
+    int n = (int) heap_.size();
+    while (true)
+    {
+        int child = 2 * i + 1;
+        if (child >= n)
+            break;
+        if (child + 1 < n && before(heap_[child + 1], heap_[child]))
+            ++child;
+        if (!before(heap_[child], e))
+            break;
+        place(i, heap_[child]);
+        i = child;
+    }
+    place(i, e);
+}
@@ -0,0 +1,53 @@
+#ifndef PRIORITYQUEUE_H
+#define PRIORITYQUEUE_H
+
+#include "utils.h"
+
+/*
+ * Indexed max-heap of fill front pixels keyed by their priority.
+ * Every pixel keeps its heap position in a position map, so a priority can
+ * be changed or removed in O(log n) and the patch with the greatest priority
+ * is found without scanning a priority image.
+ */
+class PriorityQueue
+{
+public:
+    // clear the queue for an image of the given size
+    void reset(const cv::Size& size);
+
+    // insert p or change its priority
+    void push(const cv::Point& p, float priority);
+
+    // remove p if it is queued
+    void erase(const cv::Point& p);
+
+    bool empty() const { return heap_.empty(); }
+    size_t size() const { return heap_.size(); }
+    bool contains(const cv::Point& p) const { return pos_.ptr<int>(p.y)[p.x] >= 0; }
+
+    // point with the greatest priority, ties go to the first point in raster order
+    cv::Point top() const { assert(!empty()); return heap_[0].point; }
+    float topPriority() const { assert(!empty()); return heap_[0].priority; }
+
+private:
+    struct Entry
+    {
+        float priority;
+        int index;          // raster index, used to break ties
+        cv::Point point;
+    };
+
+    bool before(const Entry& a, const Entry& b) const
+    {
+        return a.priority > b.priority || (a.priority == b.priority && a.index < b.index);
+    }
+
+    void place(int i, const Entry& e);
+    void siftUp(int i);
+    void siftDown(int i);
+
+    cv::Mat pos_;               // CV_32SC1, heap position of each pixel or -1
+    std::vector<Entry> heap_;
+};
+
+#endif
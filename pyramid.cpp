@@ -0,0 +1,257 @@
+#include "pyramid.h"
+
+#include <cstring>
+
+// coarse-to-fine exemplar inpainting
+
+
+PyramidInpainter::PyramidInpainter(const PyramidParams& params)
+    : params_(params), levels_(0)
+{}
+
+
+/*
+ * Half resolution color, depth and mask. Blocks are averaged instead of
+ * blurred so no target pixel leaks into the source, and a coarse pixel is
+ * target when any pixel of its block is.
+ */
+static void downsampleLevel(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                            cv::Mat& coarseColor, cv::Mat& coarseDepth, cv::Mat& coarseMask)
+{
+    cv::Size coarseSize((color.cols + 1) / 2, (color.rows + 1) / 2);
+    cv::resize(color, coarseColor, coarseSize, 0, 0, cv::INTER_AREA);
+    if (!depth.empty())
+        cv::resize(depth, coarseDepth, coarseSize, 0, 0, cv::INTER_AREA);
+
+    cv::Mat source = (maskMat != 0), coarseSource;
+    cv::resize(source, coarseSource, coarseSize, 0, 0, cv::INTER_AREA);
+    coarseMask = (coarseSource == 255);
+}
+
+
+/*
+ * Offsets of the finer level: every padded pixel takes the doubled offset of
+ * the coarse pixel it lies in. Both fields carry a radius wide border.
+ */
+static void upsampleOffsets(const cv::Mat& coarseOffsets, const cv::Size& size, int radius, cv::Mat& offsets)
+{
+    offsets.create(size.height + 2*radius, size.width + 2*radius, CV_32SC2);
+    offsets.setTo(cv::Scalar::all(0));
+
+    const int coarseCols = coarseOffsets.cols - 2*radius;
+    const int coarseRows = coarseOffsets.rows - 2*radius;
+    for (int y = 0; y < size.height; ++y)
+    {
+        const cv::Vec2i* coarseRow = coarseOffsets.ptr<cv::Vec2i>(std::min(y / 2, coarseRows - 1) + radius);
+        cv::Vec2i* offsetRow = offsets.ptr<cv::Vec2i>(y + radius);
+        for (int x = 0; x < size.width; ++x)
+        {
+            offsetRow[x + radius] = 2 * coarseRow[std::min(x / 2, coarseCols - 1) + radius];
+        }
+    }
+}
+
+
+/*
+ * Run the session on one level and record psiHatQ - psiHatP for every pixel
+ * of each filled patch, the first patch covering a pixel wins.
+ */
+void PyramidInpainter::inpaintLevel(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                                    const SearchParams& params, const cv::Mat& priorOffsets, cv::Mat& offsets)
+{
+    const int radius = params.radius;
+    session_.reset(color, depth, maskMat, params, priorOffsets);
+
+    offsets.create(maskMat.rows + 2*radius, maskMat.cols + 2*radius, CV_32SC2);
+    offsets.setTo(cv::Scalar::all(0));
+    while (!session_.done())
+    {
+        session_.step();
+        if (session_.failed())
+            break;
+
+        const cv::Point& psiHatP = session_.psiHatP();
+        const cv::Vec2i offset(session_.psiHatQ().x - psiHatP.x, session_.psiHatQ().y - psiHatP.y);
+        for (int y = psiHatP.y - radius; y <= psiHatP.y + radius; ++y)
+        {
+            cv::Vec2i* offsetRow = offsets.ptr<cv::Vec2i>(y);
+            for (int x = psiHatP.x - radius; x <= psiHatP.x + radius; ++x)
+            {
+                if (offsetRow[x] == cv::Vec2i(0, 0))
+                {
+                    offsetRow[x] = offset;
+                }
+            }
+        }
+    }
+}
+
+
+/*
+ * Refine the upsampled fill of the level below. The hole starts out with
+ * that fill, so every target patch is complete and is matched as a whole,
+ * without fill front or priorities. Patch centers lie on a grid of stride
+ * radius over the hole, each is searched once around its upsampled offset
+ * and its target pixels not yet refined are copied from the match.
+ */
+void PyramidInpainter::refineLevel(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                                   const cv::Mat& coarseFilled, const cv::Mat& coarseDepth, const SearchParams& params,
+                                   const cv::Mat& priorOffsets, cv::Mat& offsets, cv::Mat& filled, cv::Mat& filledDepth)
+{
+    const int radius = params.radius;
+    const cv::Mat target = (maskMat == 0);
+
+    offsets.create(maskMat.rows + 2*radius, maskMat.cols + 2*radius, CV_32SC2);
+    offsets.setTo(cv::Scalar::all(0));
+    if (cv::countNonZero(target) == 0)
+    {
+        // nothing to refine, the level is its own fill
+        color.copyTo(filled);
+        if (!depth.empty())
+            depth.copyTo(filledDepth);
+        return;
+    }
+
+    // the level with its hole taken from the level below
+    cv::Mat upsampled;
+    color.copyTo(filled);
+    cv::resize(coarseFilled, upsampled, color.size(), 0, 0, cv::INTER_LINEAR);
+    upsampled.copyTo(filled, target);
+
+    double depthScale = 1.0, depthOffset = 0.0;
+    cv::Mat normalized;
+    if (!depth.empty())
+    {
+        depth.copyTo(filledDepth);
+        cv::resize(coarseDepth, upsampled, depth.size(), 0, 0, cv::INTER_LINEAR);
+        upsampled.copyTo(filledDepth, target);
+        normalizeDepth(filledDepth, maskMat, normalized, depthScale, depthOffset);
+    }
+
+    // padded working image and masks as in InpaintingSession
+    cv::Mat work;
+    if (depth.empty())
+    {
+        filled.copyTo(work);
+    } else
+    {
+        work.create(color.size(), CV_32FC4);
+        cv::Mat sources[2] = {filled, normalized};
+        const int fromTo[] = {0, 0, 1, 1, 2, 2, 3, 3};
+        cv::mixChannels(sources, 2, &work, 1, fromTo, 4);
+    }
+    cv::copyMakeBorder(work, work_, radius, radius, radius, radius, cv::BORDER_CONSTANT, cv::Scalar::all(0));
+    cv::Mat source = (maskMat != 0);
+    cv::copyMakeBorder(source, mask_, radius, radius, radius, radius, cv::BORDER_CONSTANT, cv::Scalar(255));
+    cv::erode(mask_, eroded_, cv::Mat(), cv::Point(-1, -1), radius);
+    search_.init(params, work_, mask_, eroded_, priorOffsets);
+
+    const cv::Mat whole(2*radius + 1, 2*radius + 1, CV_8UC1, cv::Scalar(255));
+    const cv::Rect hole = cv::boundingRect(target) + cv::Point(radius, radius);
+    const size_t pixel = work_.elemSize();
+    for (int y = hole.y; y < hole.br().y + radius; y += radius)
+    {
+        const int py = std::min(y, hole.br().y - 1);
+        for (int x = hole.x; x < hole.br().x + radius; x += radius)
+        {
+            const cv::Point psiHatP(std::min(x, hole.br().x - 1), py);
+            if (cv::countNonZero(getPatch(mask_, psiHatP, radius)) == (int) whole.total())
+                continue;
+
+            cv::Point psiHatQ;
+            if (!search_.find(psiHatP, work_, whole, psiHatQ))
+                continue;
+
+            // first patch covering a target pixel wins, as in inpaintLevel
+            const cv::Vec2i offset(psiHatQ.x - psiHatP.x, psiHatQ.y - psiHatP.y);
+            for (int dy = -radius; dy <= radius; ++dy)
+            {
+                const uchar* maskRow = mask_.ptr<uchar>(psiHatP.y + dy);
+                cv::Vec2i* offsetRow = offsets.ptr<cv::Vec2i>(psiHatP.y + dy);
+                uchar* workRow = work_.ptr<uchar>(psiHatP.y + dy);
+                const uchar* sourceRow = work_.ptr<uchar>(psiHatQ.y + dy);
+                for (int dx = -radius; dx <= radius; ++dx)
+                {
+                    const int px = psiHatP.x + dx;
+                    if (maskRow[px] == 0 && offsetRow[px] == cv::Vec2i(0, 0))
+                    {
+                        offsetRow[px] = offset;
+                        std::memcpy(workRow + pixel * px, sourceRow + pixel * (psiHatQ.x + dx), pixel);
+                    }
+                }
+            }
+            search_.update(psiHatP, psiHatQ, work_, mask_);
+        }
+    }
+
+    // back to color and depth in the input unit
+    cv::Mat inner = work_(cv::Rect(radius, radius, color.cols, color.rows));
+    if (depth.empty())
+    {
+        inner.copyTo(filled);
+    } else
+    {
+        cv::cvtColor(inner, filled, CV_BGRA2BGR);
+        cv::extractChannel(inner, filledDepth, 3);
+        filledDepth.convertTo(filledDepth, CV_32F, 1.0 / depthScale, -depthOffset / depthScale);
+    }
+}
+
+
+void PyramidInpainter::process(const cv::Mat& color, const cv::Mat& maskMat, cv::Mat& filled)
+{
+    cv::Mat filledDepth;
+    process(color, cv::Mat(), maskMat, filled, filledDepth);
+}
+
+
+void PyramidInpainter::process(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                               cv::Mat& filled, cv::Mat& filledDepth)
+{
+    assert(color.size() == maskMat.size() && maskMat.type() == CV_8UC1);
+    assert(color.type() == CV_8UC3 || color.type() == CV_32FC3);
+    assert(depth.empty() || (depth.size() == maskMat.size() && depth.channels() == 1));
+    assert(params_.levels >= 0 && params_.minSize >= 1);
+
+    cv::Mat colorMat, depthMat;
+    color.convertTo(colorMat, CV_32F, color.depth() == CV_8U ? 1.0 / 255.0 : 1.0);
+    if (!depth.empty())
+        depth.convertTo(depthMat, CV_32F);
+
+    // colors[0], depths[0] and masks[0] are the input resolution
+    std::vector<cv::Mat> colors(1, colorMat), depths(1, depthMat), masks(1, maskMat);
+    while ((int) colors.size() <= params_.levels &&
+           std::min(colors.back().rows, colors.back().cols) / 2 >= params_.minSize)
+    {
+        cv::Mat coarseColor, coarseDepth, coarseMask;
+        downsampleLevel(colors.back(), depths.back(), masks.back(), coarseColor, coarseDepth, coarseMask);
+        colors.push_back(coarseColor);
+        depths.push_back(coarseDepth);
+        masks.push_back(coarseMask);
+    }
+    levels_ = (int) colors.size();
+
+    const int radius = params_.coarse.radius;
+    SearchParams refine = params_.coarse;
+    refine.strategy = SEARCH_PATCHMATCH;
+    refine.searchRadius = params_.refineRadius;
+    refine.iterations = params_.refineIterations;
+
+    // full search at the coarsest level, then refine the upsampled fill upwards
+    cv::Mat offsets, priorOffsets;
+    inpaintLevel(colors.back(), depths.back(), masks.back(), params_.coarse, cv::Mat(), offsets);
+    cv::Rect inner(radius, radius, masks.back().cols, masks.back().rows);
+    filled = session_.colorMat(inner);
+    if (depthMat.empty())
+        filledDepth.release();
+    else
+        filledDepth = session_.depthMat(inner);
+
+    for (int level = levels_ - 2; level >= 0; --level)
+    {
+        upsampleOffsets(offsets, masks[level].size(), radius, priorOffsets);
+        cv::Mat coarseFilled = filled, coarseDepth = filledDepth;
+        refineLevel(colors[level], depths[level], masks[level], coarseFilled, coarseDepth, refine, priorOffsets,
+                    offsets, filled, filledDepth);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef PYRAMID_H
+#define PYRAMID_H
+
+#include "utils.h"
+#include "session.h"
+
+struct PyramidParams
+{
+    int levels;             // coarser levels below the input, 0 inpaints at full resolution only
+    int minSize;            // no level whose shorter side is below minSize pixels
+    SearchParams coarse;    // search of the coarsest level, its radius is used on every level
+    int refineRadius;       // finer levels: PatchMatch random search radius around the upsampled match
+    int refineIterations;   // finer levels: PatchMatch iterations per refined patch
+
+    PyramidParams()
+        : levels(3), minSize(32), refineRadius(4), refineIterations(2)
+    {}
+};
+
+/*
+ * Coarse-to-fine exemplar inpainting. The hole is filled at the coarsest
+ * level by the full session with the coarse search, which is cheap there.
+ * Every finer level starts from the fill of the level below, upsampled by 2,
+ * and only refines it: one PatchMatch search per patch of a grid over the
+ * hole, seeded with the upsampled offsets. The fine levels run no fill
+ * front, priorities or global search, so large holes cost about as much per
+ * patch as small ones.
+ */
+class PyramidInpainter
+{
+public:
+    explicit PyramidInpainter(const PyramidParams& params = PyramidParams());
+
+    // color - CV_8UC3 or CV_32FC3 in [0, 1], without border
+    // maskMat - CV_8UC1, 0 for the target region
+    // filled receives CV_32FC3 in [0, 1]
+    void process(const cv::Mat& color, const cv::Mat& maskMat, cv::Mat& filled);
+
+    // RGB-D: depth is single channel without border in any unit, matched and
+    // filled together with color, filledDepth receives CV_32FC1 in the same unit.
+    // Every level normalizes depth like InpaintingSession::reset.
+    void process(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                 cv::Mat& filled, cv::Mat& filledDepth);
+
+    // number of levels used by the last call, including the input resolution
+    int levels() const { return levels_; }
+
+private:
+    void inpaintLevel(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat, const SearchParams& params,
+                      const cv::Mat& priorOffsets, cv::Mat& offsets);
+    void refineLevel(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                     const cv::Mat& coarseFilled, const cv::Mat& coarseDepth, const SearchParams& params,
+                     const cv::Mat& priorOffsets, cv::Mat& offsets, cv::Mat& filled, cv::Mat& filledDepth);
+
+    PyramidParams params_;
+    InpaintingSession session_;     // coarsest level
+    PatchSearch search_;            // finer levels
+    cv::Mat work_;                  // finer levels: padded color and depth, as in the session
+    cv::Mat mask_;                  // finer levels: padded mask, 0 for the target region
+    cv::Mat eroded_;                // mask_ eroded by the radius
+    int levels_;
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "session.h"
+
+// exemplar based inpainting loop
+
+
+/*
+ * Set the radius wide border of a padded buffer to value.
+ */
+static void setBorder(cv::Mat& mat, int radius, const cv::Scalar& value)
+{
+    mat.rowRange(0, radius).setTo(value);
+    mat.rowRange(mat.rows - radius, mat.rows).setTo(value);
+    mat(cv::Rect(0, radius, radius, mat.rows - 2*radius)).setTo(value);
+    mat(cv::Rect(mat.cols - radius, radius, radius, mat.rows - 2*radius)).setTo(value);
+}
+
+
+void InpaintingSession::init(const cv::Mat& colorMat, const cv::Mat& maskMat, const SearchParams& params,
+                             const cv::Mat& priorOffsets)
+{
+    init(colorMat, cv::Mat(), maskMat, params, priorOffsets);
+}
+
+
+void InpaintingSession::init(const cv::Mat& colorMat, const cv::Mat& depthMat, const cv::Mat& maskMat,
+                             const SearchParams& params, const cv::Mat& priorOffsets)
+{
+    assert(colorMat.type() == CV_32FC3 && maskMat.type() == CV_8UC1);
+    assert(colorMat.rows == maskMat.rows + 2*params.radius && colorMat.cols == maskMat.cols + 2*params.radius);
+    assert(depthMat.empty() || (depthMat.type() == CV_32FC1 && depthMat.size() == colorMat.size()));
+
+    radius_ = params.radius;
+    depth_ = !depthMat.empty();
+    depthScale_ = 1.0;
+    depthOffset_ = 0.0;
+    if (depth_)
+    {
+        // the range of the source depth, the border stays 0
+        cv::Rect inner(radius_, radius_, maskMat.cols, maskMat.rows);
+        cv::Mat depth = cv::Mat::zeros(colorMat.size(), CV_32FC1);
+        cv::Mat innerDepth = depth(inner);
+        normalizeDepth(depthMat(inner), maskMat, innerDepth, depthScale_, depthOffset_);
+
+        workMat_.create(colorMat.size(), CV_32FC4);
+        cv::Mat sources[2] = {colorMat, depth};
+        const int fromTo[] = {0, 0, 1, 1, 2, 2, 3, 3};
+        cv::mixChannels(sources, 2, &workMat_, 1, fromTo, 4);
+    }
+    else
+    {
+        colorMat.copyTo(workMat_);
+    }
+
+    prepare(maskMat, params, priorOffsets);
+}
+
+
+void InpaintingSession::reset(const cv::Mat& color, const cv::Mat& maskMat, const SearchParams& params,
+                              const cv::Mat& priorOffsets)
+{
+    reset(color, cv::Mat(), maskMat, params, priorOffsets);
+}
+
+
+void InpaintingSession::reset(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                              const SearchParams& params, const cv::Mat& priorOffsets)
+{
+    assert(color.type() == CV_8UC3 || color.type() == CV_32FC3);
+    assert(maskMat.type() == CV_8UC1 && color.size() == maskMat.size());
+    assert(depth.empty() || (depth.channels() == 1 && depth.size() == maskMat.size()));
+
+    // pad straight into the working buffer
+    radius_ = params.radius;
+    depth_ = !depth.empty();
+    workMat_.create(color.rows + 2*radius_, color.cols + 2*radius_, depth_ ? CV_32FC4 : CV_32FC3);
+    setBorder(workMat_, radius_, cv::Scalar::all(0));
+    cv::Mat inner = workMat_(cv::Rect(radius_, radius_, color.cols, color.rows));
+
+    depthScale_ = 1.0;
+    depthOffset_ = 0.0;
+    if (depth_)
+    {
+        // staged in buffers that are kept across resets
+        cv::Mat colorMat = color;
+        if (color.depth() != CV_32F)
+        {
+            color.convertTo(colorBuffer_, CV_32F, 1.0 / 255.0);
+            colorMat = colorBuffer_;
+        }
+        normalizeDepth(depth, maskMat, depthBuffer_, depthScale_, depthOffset_);
+        cv::Mat sources[2] = {colorMat, depthBuffer_};
+        const int fromTo[] = {0, 0, 1, 1, 2, 2, 3, 3};
+        cv::mixChannels(sources, 2, &inner, 1, fromTo, 4);
+    }
+    else
+    {
+        color.convertTo(inner, CV_32F, color.depth() == CV_32F ? 1.0 : 1.0 / 255.0);
+    }
+
+    prepare(maskMat, params, priorOffsets);
+}
+
+
+cv::Mat InpaintingSession::colorMat() const
+{
+    return colorMat(cv::Rect(0, 0, workMat_.cols, workMat_.rows));
+}
+
+
+/*
+ * Only roi is copied. Without a depth that is a plain copy of the working
+ * image, with a depth the D channel is dropped on the way.
+ */
+cv::Mat InpaintingSession::colorMat(const cv::Rect& roi) const
+{
+    if (!depth_)
+        return workMat_(roi).clone();
+
+    cv::Mat colorMat;
+    cv::cvtColor(workMat_(roi), colorMat, CV_BGRA2BGR);
+    return colorMat;
+}
+
+
+cv::Mat InpaintingSession::depthMat() const
+{
+    return depthMat(cv::Rect(0, 0, workMat_.cols, workMat_.rows));
+}
+
+
+cv::Mat InpaintingSession::depthMat(const cv::Rect& roi) const
+{
+    cv::Mat depthMat;
+    if (depth_)
+    {
+        // back to the units of the input depth
+        cv::extractChannel(workMat_(roi), depthMat, 3);
+        depthMat.convertTo(depthMat, CV_32F, 1.0 / depthScale_, -depthOffset_ / depthScale_);
+    }
+    return depthMat;
+}
+
+
+/*
+ * Derive every other buffer from workMat_ and maskMat. Buffers of an
+ * earlier run with the same size are written in place.
+ */
+void InpaintingSession::prepare(const cv::Mat& maskMat, const SearchParams& params, const cv::Mat& priorOffsets)
+{
+    cv::cvtColor(workMat_, grayMat_, depth_ ? CV_BGRA2GRAY : CV_BGR2GRAY);
+    cv::Rect inner(radius_, radius_, maskMat.cols, maskMat.rows);
+
+    // confidenceMat - 1 for source, 0 for target, with a border of 0.0001
+    confidenceMat_.create(workMat_.size(), CV_32FC1);
+    setBorder(confidenceMat_, radius_, cv::Scalar(0.0001f));
+    cv::Mat confidence = confidenceMat_(inner);
+    maskMat.convertTo(confidence, CV_32F, 1.0 / 255.0);
+
+    // maskMat - 255 for source, 0 for target, with a border of 255
+    maskMat_.create(workMat_.size(), CV_8UC1);
+    setBorder(maskMat_, radius_, cv::Scalar(255));
+    cv::Mat mask = maskMat_(inner);
+    cv::compare(maskMat, 0, mask, cv::CMP_NE);
+
+    assert(
+           workMat_.size() == grayMat_.size() &&
+           workMat_.size() == confidenceMat_.size() &&
+           workMat_.size() == maskMat_.size()
+           );
+
+    remaining_ = maskMat_.total() - cv::countNonZero(maskMat_);
+    failed_ = false;
+
+    // eroded mask is used to ensure that psiHatQ is not overlapping with target
+    cv::erode(maskMat_, erodedMask_, cv::Mat(), cv::Point(-1, -1), radius_);
+    search_.init(params, workMat_, maskMat_, erodedMask_, priorOffsets);
+
+    // trace the fill front once, it is maintained locally afterwards
+    front_.build(maskMat_);
+
+    // compute the isophotes and the priority for all fill front points once
+    isophotes_.build(grayMat_, confidenceMat_);
+    computePriority(front_, isophotes_, confidenceMat_, queue_, radius_);
+}
+
+
+void InpaintingSession::step()
+{
+    assert(!done() && !queue_.empty());
+
+    // get the patch with the greatest priority
+    psiHatP_ = queue_.top();
+    cv::Mat psiHatPMask = getPatch(maskMat_, psiHatP_, radius_);
+    cv::Mat psiHatPConfidence = getPatch(confidenceMat_, psiHatP_, radius_);
+
+    // get the patch in source with least distance to psiHatP wrt source of psiHatP
+    if (!search_.find(psiHatP_, workMat_, psiHatPMask, psiHatQ_))
+    {
+        failed_ = true;
+        return;
+    }
+    assert(psiHatQ_ != psiHatP_);
+
+    // copy from psiHatQ to psiHatP, color and depth in one pass and gray,
+    // only the target pixels of the patch are written
+    cv::Mat targetMask = (psiHatPMask == 0);
+    getPatch(workMat_, psiHatQ_, radius_).copyTo(getPatch(workMat_, psiHatP_, radius_), targetMask);
+    getPatch(grayMat_, psiHatQ_, radius_).copyTo(getPatch(grayMat_, psiHatP_, radius_), targetMask);
+
+    // fill in confidenceMat with confidences C(pixel) = C(psiHatP) and
+    // update maskMat and the number of target pixels left
+    float confidence = (float) computeConfidence(psiHatPConfidence);
+    assert(0 <= confidence && confidence <= 1.0f);
+    for (int y = 0; y < psiHatPMask.rows; ++y)
+    {
+        uchar* maskRow = psiHatPMask.ptr<uchar>(y);
+        float* confidenceRow = psiHatPConfidence.ptr<float>(y);
+        for (int x = 0; x < psiHatPMask.cols; ++x)
+        {
+            if (maskRow[x] == 0)
+            {
+                maskRow[x] = 255;
+                confidenceRow[x] = confidence;
+                --remaining_;
+            }
+        }
+    }
+
+    // update the fill front, isophotes and priorities around the filled patch
+    search_.update(psiHatP_, psiHatQ_, workMat_, maskMat_);
+    front_.update(psiHatP_, maskMat_, radius_);
+    isophotes_.update(psiHatP_, grayMat_, confidenceMat_, radius_);
+    updatePriority(front_, psiHatP_, isophotes_, confidenceMat_, queue_, radius_);
+}
+
+
+void InpaintingSession::run()
+{
+    // end when target is filled
+    while (!done())
+    {
+        step();
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "utils.h"
+#include "fillfront.h"
+#include "priorityqueue.h"
+#include "isophotes.h"
+#include "patchsearch.h"
+
+/*
+ * State of one exemplar based inpainting run. The session keeps the mask,
+ * the confidence and the number of unfilled pixels up to date patch by
+ * patch, so no iteration needs a full-image pass. A session can be reset
+ * with new inputs any number of times; the padded working, gray, confidence,
+ * mask and priority buffers are reused while the image size stays the same.
+ *
+ * Color and depth live in one working image, B, G, R and D interleaved in
+ * 16 bytes per pixel. Without a depth it is just B, G, R in 12 bytes. A
+ * patch is one contiguous run per row, so each step copies it once and the
+ * search compares color and depth in the same pass.
+ */
+class InpaintingSession
+{
+public:
+    // colorMat - CV_32FC3 color image with a params.radius border, as loaded by loadInpaintingImages
+    // maskMat  - CV_8UC1 mask without border, 0 for the target region
+    // priorOffsets - see PatchSearch::init
+    void init(const cv::Mat& colorMat, const cv::Mat& maskMat, const SearchParams& params = SearchParams(),
+              const cv::Mat& priorOffsets = cv::Mat());
+
+    // RGB-D: depthMat is CV_32FC1 with the same border, in any unit. The session
+    // maps the depth range of the source region to [0, 1], the range of color,
+    // and compares patches on color plus params.depthWeight times that depth.
+    // Depth is filled together with color and returned in the input unit.
+    void init(const cv::Mat& colorMat, const cv::Mat& depthMat, const cv::Mat& maskMat,
+              const SearchParams& params = SearchParams(), const cv::Mat& priorOffsets = cv::Mat());
+
+    // same as init, but color is CV_8UC3 or CV_32FC3 in [0, 1] without border,
+    // it is padded straight into the session's buffer
+    void reset(const cv::Mat& color, const cv::Mat& maskMat, const SearchParams& params = SearchParams(),
+               const cv::Mat& priorOffsets = cv::Mat());
+
+    // RGB-D reset, depth is single channel without border in any unit,
+    // normalized as for init
+    void reset(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+               const SearchParams& params = SearchParams(), const cv::Mat& priorOffsets = cv::Mat());
+
+    // fill the patch with the greatest priority, stops the session when the
+    // source region holds no complete patch
+    void step();
+
+    // fill the whole target region
+    void run();
+
+    bool done() const { return remaining_ == 0 || failed_; }
+    // no source patch to fill from, remaining() target pixels are left unfilled
+    bool failed() const { return failed_; }
+    size_t remaining() const { return remaining_; }
+
+    // patch filled by the last step and the source patch it was copied from
+    const cv::Point& psiHatP() const { return psiHatP_; }
+    const cv::Point& psiHatQ() const { return psiHatQ_; }
+
+    // CV_32FC4 B, G, R, D + border, CV_32FC3 without a depth
+    const cv::Mat& workMat() const { return workMat_; }
+    // color + border as CV_32FC3, a copy of the working image's color
+    cv::Mat colorMat() const;
+    // copy of the color of roi only, in padded coordinates
+    cv::Mat colorMat(const cv::Rect& roi) const;
+    // depth + border as CV_32FC1 in the input unit, empty unless the session was given a depth
+    cv::Mat depthMat() const;
+    cv::Mat depthMat(const cv::Rect& roi) const;
+    const cv::Mat& maskMat() const { return maskMat_; }
+    const cv::Mat& confidenceMat() const { return confidenceMat_; }
+    const cv::Mat& offsets() const { return search_.offsets(); }
+
+private:
+    void prepare(const cv::Mat& maskMat, const SearchParams& params, const cv::Mat& priorOffsets);
+
+    cv::Mat workMat_;           // color and depth picture + border, interleaved
+    bool depth_;                // workMat_ holds a depth
+    double depthScale_;         // workMat_ depth = input depth * depthScale_ + depthOffset_
+    double depthOffset_;
+    cv::Mat colorBuffer_;       // reset: 8 bit color as float, before it is interleaved
+    cv::Mat depthBuffer_;       // reset: normalized depth, before it is interleaved
+    cv::Mat grayMat_;           // gray picture + border
+    cv::Mat confidenceMat_;     // confidence picture + border
+    cv::Mat maskMat_;           // 255 for source, 0 for target + border
+    cv::Mat erodedMask_;        // maskMat_ eroded by radius_, valid psiHatQ
+    int radius_;                // patch radius and border width
+
+    FillFront front_;
+    PriorityQueue queue_;
+    IsophoteCache isophotes_;
+    PatchSearch search_;
+
+    size_t remaining_;          // number of target pixels left
+    bool failed_;               // search found no psiHatQ
+    cv::Point psiHatP_;
+    cv::Point psiHatQ_;
+};
+
+#endif
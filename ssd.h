@@ -0,0 +1,390 @@
+#ifndef SSD_H
+#define SSD_H
+
+#include "utils.h"
+
+#include <cfloat>
+#include <algorithm>
+
+// SSE2 is part of every x86-64 target, so the kernels always use it there.
+// The AVX2 kernels are compiled for their own target and picked at run time
+// when the CPU has AVX2, or always when the build targets AVX2.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SSD_SSE2 1
+#include <immintrin.h>
+#endif
+
+#if defined(SSD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define SSD_AVX2 1
+#define SSD_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(__AVX2__)
+#define SSD_AVX2 1
+#define SSD_TARGET_AVX2
+#endif
+
+/*
+ * List the rows of a SIZE x SIZE patch mask with known pixels in order,
+ * densest first, and return their number.
+ */
+template<int SIZE>
+inline int orderRows(const cv::Mat& mask, int* order)
+{
+    int known[SIZE] = {0};
+    int rows = 0;
+    for (int y = 0; y < SIZE; ++y)
+    {
+        const uchar* maskRow = mask.ptr<uchar>(y);
+        for (int x = 0; x < SIZE; ++x)
+        {
+            known[y] += maskRow[x] != 0;
+        }
+
+        if (known[y] != 0)
+        {
+            order[rows++] = y;
+        }
+    }
+
+    // stable, so rows with the same count keep the top to bottom order
+    std::stable_sort(order, order + rows, [&known](int a, int b) { return known[a] > known[b]; });
+    return rows;
+}
+
+
+/*
+ * Target patch of a masked SSD with radius R: the (2R+1) rows of CN
+ * interleaved floats per pixel (BGR, or BGR and depth) and the single
+ * channel mask expanded to one weight per float, so the kernel runs over
+ * each row as one contiguous vector.
+ */
+template<int R, int CN = 3>
+struct MaskedTemplate
+{
+    enum { SIZE = 2*R + 1, ROW = CN * SIZE, CHANNELS = CN };
+    typedef float Value;
+
+    alignas(32) float values[SIZE][ROW];
+    alignas(32) float weights[SIZE][ROW];
+    int order[SIZE];        // rows with known pixels, densest first
+    int rows;               // number of entries in order
+
+    // tmplate - CV_32FC(CN) patch, mask - CV_8UC1 patch, non zero for known pixels
+    // channelWeights - CN factors applied to the channel differences before squaring, NULL for 1
+    void set(const cv::Mat& tmplate, const cv::Mat& mask, const float* channelWeights = NULL)
+    {
+        assert(tmplate.type() == CV_32FC(CN) && mask.type() == CV_8UC1);
+        assert(tmplate.rows == SIZE && tmplate.cols == SIZE && mask.size() == tmplate.size());
+
+        for (int y = 0; y < SIZE; ++y)
+        {
+            const float* tmplateRow = tmplate.ptr<float>(y);
+            const uchar* maskRow = mask.ptr<uchar>(y);
+            for (int i = 0; i < ROW; ++i)
+            {
+                float valid = maskRow[i / CN] != 0 ? 1.0f : 0.0f;
+                weights[y][i] = channelWeights ? valid * channelWeights[i % CN] : valid;
+                values[y][i] = tmplateRow[i] * valid;
+            }
+        }
+        rows = orderRows<SIZE>(mask, order);
+    }
+};
+
+
+/*
+ * Target patch of the 8 bit search image, a quarter of the bytes of the
+ * float template. Channel weights are applied when the image is quantized,
+ * so the mask is all that weighs the differences: 0xFF for every byte of a
+ * known pixel, 0 otherwise.
+ */
+template<int R, int CN = 4>
+struct QuantizedTemplate
+{
+    enum { SIZE = 2*R + 1, ROW = CN * SIZE, CHANNELS = CN };
+    typedef uchar Value;
+
+    alignas(32) uchar values[SIZE][ROW];
+    alignas(32) uchar masks[SIZE][ROW];
+    int order[SIZE];        // rows with known pixels, densest first
+    int rows;               // number of entries in order
+
+    // tmplate - CV_8UC(CN) patch, mask - CV_8UC1 patch, non zero for known pixels
+    void set(const cv::Mat& tmplate, const cv::Mat& mask)
+    {
+        assert(tmplate.type() == CV_8UC(CN) && mask.type() == CV_8UC1);
+        assert(tmplate.rows == SIZE && tmplate.cols == SIZE && mask.size() == tmplate.size());
+
+        for (int y = 0; y < SIZE; ++y)
+        {
+            const uchar* tmplateRow = tmplate.ptr<uchar>(y);
+            const uchar* maskRow = mask.ptr<uchar>(y);
+            for (int i = 0; i < ROW; ++i)
+            {
+                masks[y][i] = maskRow[i / CN] != 0 ? 0xFF : 0;
+                values[y][i] = tmplateRow[i] & masks[y][i];
+            }
+        }
+        rows = orderRows<SIZE>(mask, order);
+    }
+};
+
+
+/*
+ * True when the AVX2 kernels may run, checked once per process.
+ */
+inline bool hasAVX2()
+{
+#if defined(__AVX2__)
+    return true;
+#elif defined(SSD_AVX2)
+    static const bool avx2 = (__builtin_cpu_init(), __builtin_cpu_supports("avx2") != 0);
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+
+#if defined(SSD_SSE2)
+inline float sumLanes(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+
+inline int sumLanes(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+#endif
+
+
+/*
+ * Masked sum of squared differences of one row of n interleaved floats,
+ * 4 floats at a time with SSE2, scalar elsewhere.
+ */
+inline float maskedRowSSDSSE2(const float* values, const float* weights, const float* source, int n)
+{
+    int i = 0;
+    float sum = 0.0f;
+#if defined(SSD_SSE2)
+    __m128 acc4 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(source + i), _mm_loadu_ps(values + i));
+        d = _mm_mul_ps(d, _mm_loadu_ps(weights + i));
+        acc4 = _mm_add_ps(acc4, _mm_mul_ps(d, d));
+    }
+    sum = sumLanes(acc4);
+#endif
+    for (; i < n; ++i)
+    {
+        float d = (source[i] - values[i]) * weights[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+
+/*
+ * Masked sum of squared differences of one row of n bytes. The bytes are
+ * widened to 16 bits and the squares summed pairwise into 32 bits (pmaddwd),
+ * exact for any patch size used here.
+ */
+inline int quantizedRowSSDSSE2(const uchar* values, const uchar* masks, const uchar* source, int n)
+{
+    int i = 0;
+    int sum = 0;
+#if defined(SSD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc4 = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*) (source + i));
+        __m128i t = _mm_loadu_si128((const __m128i*) (values + i));
+        __m128i m = _mm_loadu_si128((const __m128i*) (masks + i));
+        __m128i lo = _mm_and_si128(_mm_sub_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(t, zero)),
+                                   _mm_unpacklo_epi8(m, m));
+        __m128i hi = _mm_and_si128(_mm_sub_epi16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(t, zero)),
+                                   _mm_unpackhi_epi8(m, m));
+        acc4 = _mm_add_epi32(acc4, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+    }
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i s = _mm_loadl_epi64((const __m128i*) (source + i));
+        __m128i t = _mm_loadl_epi64((const __m128i*) (values + i));
+        __m128i m = _mm_loadl_epi64((const __m128i*) (masks + i));
+        __m128i d = _mm_and_si128(_mm_sub_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(t, zero)),
+                                  _mm_unpacklo_epi8(m, m));
+        acc4 = _mm_add_epi32(acc4, _mm_madd_epi16(d, d));
+    }
+    sum = sumLanes(acc4);
+#endif
+    for (; i < n; ++i)
+    {
+        int d = masks[i] ? (int) source[i] - (int) values[i] : 0;
+        sum += d * d;
+    }
+    return sum;
+}
+
+
+#if defined(SSD_AVX2)
+/*
+ * The row kernels with 8 floats or 16 bytes at a time, the rest goes to
+ * the SSE2 kernels.
+ */
+SSD_TARGET_AVX2 inline float maskedRowSSDAVX2(const float* values, const float* weights, const float* source, int n)
+{
+    int i = 0;
+    __m256 acc8 = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(source + i), _mm256_loadu_ps(values + i));
+        d = _mm256_mul_ps(d, _mm256_loadu_ps(weights + i));
+        acc8 = _mm256_add_ps(acc8, _mm256_mul_ps(d, d));
+    }
+    float sum = sumLanes(_mm_add_ps(_mm256_castps256_ps128(acc8), _mm256_extractf128_ps(acc8, 1)));
+    return sum + maskedRowSSDSSE2(values + i, weights + i, source + i, n - i);
+}
+
+
+SSD_TARGET_AVX2 inline int quantizedRowSSDAVX2(const uchar* values, const uchar* masks, const uchar* source, int n)
+{
+    int i = 0;
+    __m256i acc8 = _mm256_setzero_si256();
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (source + i)));
+        __m256i t = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*) (values + i)));
+        __m256i m = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (masks + i)));
+        __m256i d = _mm256_and_si256(_mm256_sub_epi16(s, t), m);
+        acc8 = _mm256_add_epi32(acc8, _mm256_madd_epi16(d, d));
+    }
+    int sum = sumLanes(_mm_add_epi32(_mm256_castsi256_si128(acc8), _mm256_extracti128_si256(acc8, 1)));
+    return sum + quantizedRowSSDSSE2(values + i, masks + i, source + i, n - i);
+}
+#endif
+
+
+inline float maskedRowSSD(const float* values, const float* weights, const float* source, int n)
+{
+#if defined(SSD_AVX2)
+    if (hasAVX2())
+        return maskedRowSSDAVX2(values, weights, source, n);
+#endif
+    return maskedRowSSDSSE2(values, weights, source, n);
+}
+
+
+inline int quantizedRowSSD(const uchar* values, const uchar* masks, const uchar* source, int n)
+{
+#if defined(SSD_AVX2)
+    if (hasAVX2())
+        return quantizedRowSSDAVX2(values, masks, source, n);
+#endif
+    return quantizedRowSSDSSE2(values, masks, source, n);
+}
+
+
+/*
+ * Masked sum of squared differences between t and the source patch whose
+ * top left pixel is at source, with step floats between source rows.
+ * Equal to the CV_TM_SQDIFF score of cv::matchTemplate with the mask.
+ *
+ * Rows are visited from the most to the least known pixels and rows
+ * without known pixels are skipped. Once the running sum exceeds bound the
+ * candidate cannot beat it and the partial sum is returned. Every row adds
+ * a non negative term, so a candidate below bound is always fully summed
+ * and scores the same as without a bound.
+ */
+template<int R, int CN>
+inline float maskedSSD(const MaskedTemplate<R, CN>& t, const float* source, size_t step, float bound = FLT_MAX);
+
+
+#if defined(SSD_AVX2)
+template<int R, int CN>
+SSD_TARGET_AVX2 inline float maskedSSDAVX2(const MaskedTemplate<R, CN>& t, const float* source, size_t step, float bound)
+{
+    float sum = 0.0f;
+    for (int k = 0; k < t.rows; ++k)
+    {
+        const int y = t.order[k];
+        sum += maskedRowSSDAVX2(t.values[y], t.weights[y], source + y * step, MaskedTemplate<R, CN>::ROW);
+        if (sum > bound)
+            break;
+    }
+    return sum;
+}
+#endif
+
+
+template<int R, int CN>
+inline float maskedSSD(const MaskedTemplate<R, CN>& t, const float* source, size_t step, float bound)
+{
+#if defined(SSD_AVX2)
+    if (hasAVX2())
+        return maskedSSDAVX2(t, source, step, bound);
+#endif
+    float sum = 0.0f;
+    for (int k = 0; k < t.rows; ++k)
+    {
+        const int y = t.order[k];
+        sum += maskedRowSSDSSE2(t.values[y], t.weights[y], source + y * step, MaskedTemplate<R, CN>::ROW);
+        if (sum > bound)
+            break;
+    }
+    return sum;
+}
+
+
+/*
+ * maskedSSD on the 8 bit search image, in squared quantization steps.
+ * The sum is exact in integers, the float result only carries it to the
+ * search, which compares distances of one template with each other.
+ */
+template<int R, int CN>
+inline float maskedSSD(const QuantizedTemplate<R, CN>& t, const uchar* source, size_t step, float bound = FLT_MAX);
+
+
+#if defined(SSD_AVX2)
+template<int R, int CN>
+SSD_TARGET_AVX2 inline float quantizedSSDAVX2(const QuantizedTemplate<R, CN>& t, const uchar* source, size_t step,
+                                              float bound)
+{
+    int sum = 0;
+    for (int k = 0; k < t.rows; ++k)
+    {
+        const int y = t.order[k];
+        sum += quantizedRowSSDAVX2(t.values[y], t.masks[y], source + y * step, QuantizedTemplate<R, CN>::ROW);
+        if (sum > bound)
+            break;
+    }
+    return (float) sum;
+}
+#endif
+
+
+template<int R, int CN>
+inline float maskedSSD(const QuantizedTemplate<R, CN>& t, const uchar* source, size_t step, float bound)
+{
+#if defined(SSD_AVX2)
+    if (hasAVX2())
+        return quantizedSSDAVX2(t, source, step, bound);
+#endif
+    int sum = 0;
+    for (int k = 0; k < t.rows; ++k)
+    {
+        const int y = t.order[k];
+        sum += quantizedRowSSDSSE2(t.values[y], t.masks[y], source + y * step, QuantizedTemplate<R, CN>::ROW);
+        if (sum > bound)
+            break;
+    }
+    return (float) sum;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#include "stream.h"
+
+// RGB-D video inpainting with temporal reuse
+
+
+StreamInpainter::StreamInpainter(const StreamParams& params)
+    : params_(params), finishMilliseconds_(-1), frames_(0), reused_(0), inpainted_(0), smoothed_(0),
+      milliseconds_(0)
+{}
+
+
+void StreamInpainter::reset()
+{
+    prevColor_.release();
+    prevMask_.release();
+    prevFilled_.release();
+    prevFilledDepth_.release();
+    prevOffsets_.release();
+    finishMilliseconds_ = -1;
+    frames_ = 0;
+    reused_ = inpainted_ = smoothed_ = 0;
+    milliseconds_ = 0;
+}
+
+
+/*
+ * Target pixels whose previous fill is still valid: target in both frames,
+ * and no mask change or changed source pixel within a patch diameter.
+ */
+cv::Mat StreamInpainter::reusableMask(const cv::Mat& color, const cv::Mat& maskMat) const
+{
+    cv::Mat reusable;
+    if (prevFilled_.empty() || prevMask_.size() != maskMat.size())
+        return reusable;
+
+    // largest channel difference of each pixel
+    cv::Mat difference, pixelDifference;
+    cv::absdiff(color, prevColor_, difference);
+    cv::reduce(difference.reshape(1, (int) difference.total()), pixelDifference, 1, CV_REDUCE_MAX);
+    pixelDifference = pixelDifference.reshape(1, color.rows);
+
+    cv::Mat source = (maskMat != 0), prevSource = (prevMask_ != 0);
+    cv::Mat changed = (pixelDifference > params_.changeThreshold) & source & prevSource;
+    changed |= (source != prevSource);
+    cv::dilate(changed, changed, cv::getStructuringElement(cv::MORPH_RECT, cv::Size(4*params_.search.radius + 1, 4*params_.search.radius + 1)));
+
+    reusable = (maskMat == 0) & (prevMask_ == 0) & (changed == 0);
+    return reusable;
+}
+
+
+/*
+ * Membrane fill of each color channel and the depth in one batched solve,
+ * the fallback when the exemplar budget runs out.
+ */
+void StreamInpainter::fillSmooth(cv::Mat& color, cv::Mat& depth, const cv::Mat& fillRegion)
+{
+    std::vector<cv::Mat> channels;
+    cv::split(color, channels);
+    if (!depth.empty())
+        channels.push_back(depth);
+    std::vector<cv::Mat> laplacians(channels.size(), cv::Mat::zeros(color.size(), CV_32F));
+
+    // in place, so the solve writes through to depth instead of replacing the headers
+    ReconstructParams params = params_.smooth;
+    params.inPlace = true;
+    reconstruct(channels, fillRegion, laplacians, channels, params);
+    cv::merge(std::vector<cv::Mat>(channels.begin(), channels.begin() + 3), color);
+}
+
+
+/*
+ * Color and depth of the session without border, the target it left
+ * filled smoothly.
+ */
+void StreamInpainter::finish(cv::Mat& filledColor, cv::Mat& filledDepth, bool depth)
+{
+    const int radius = params_.search.radius;
+    cv::Rect inner(radius, radius, session_.maskMat().cols - 2*radius, session_.maskMat().rows - 2*radius);
+    filledColor = session_.colorMat(inner);
+    if (depth)
+        filledDepth = session_.depthMat(inner);
+    else
+        filledDepth.release();
+    if (session_.remaining() > 0)
+    {
+        cv::Mat unfilled = (session_.maskMat()(inner) == 0);
+        fillSmooth(filledColor, filledDepth, unfilled);
+    }
+}
+
+
+/*
+ * The budget covers the whole call. The exemplar loop stops before its next
+ * step would leave less than the finishing time of recent frames, which the
+ * first frame measures on its whole target before it steps. The session is
+ * reset every frame, so the fill front is traced again from the new mask.
+ */
+void StreamInpainter::process(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                              cv::Mat& filledColor, cv::Mat& filledDepth)
+{
+    assert(color.size() == maskMat.size() && maskMat.type() == CV_8UC1);
+    assert(color.type() == CV_8UC3 || color.type() == CV_32FC3);
+    assert(depth.empty() || (depth.size() == maskMat.size() && depth.channels() == 1));
+
+    const int64 start = cv::getTickCount();
+    const double tickMilliseconds = 1000.0 / cv::getTickFrequency();
+
+    cv::Mat colorMat;
+    color.convertTo(colorMat, CV_32F, color.depth() == CV_8U ? 1.0 / 255.0 : 1.0);
+
+    // reuse the previous fill where nothing around it changed
+    cv::Mat workMask = maskMat.clone();
+    cv::Mat workColor = colorMat.clone();
+    cv::Mat workDepth;
+    if (!depth.empty())
+        depth.convertTo(workDepth, CV_32F);
+    cv::Mat reusable = reusableMask(colorMat, maskMat);
+    reused_ = 0;
+    if (!reusable.empty())
+    {
+        prevFilled_.copyTo(workColor, reusable);
+        if (!workDepth.empty() && prevFilledDepth_.size() == workDepth.size())
+            prevFilledDepth_.copyTo(workDepth, reusable);
+        workMask.setTo(255, reusable);
+        reused_ = cv::countNonZero(reusable);
+    }
+
+    // exemplar inpainting of color and depth together, within the time budget
+    int radius = params_.search.radius;
+    cv::Size padded(maskMat.cols + 2*radius, maskMat.rows + 2*radius);
+    cv::Mat priorOffsets = prevOffsets_.size() == padded ? prevOffsets_ : cv::Mat();
+    session_.reset(workColor, workDepth, workMask, params_.search, priorOffsets);
+
+    // without an earlier frame, time the finish of the whole target once so the
+    // budget has a bound for it
+    if (params_.maxMilliseconds > 0 && finishMilliseconds_ < 0 && session_.remaining() > 0)
+    {
+        int64 finishStart = cv::getTickCount();
+        finish(filledColor, filledDepth, !workDepth.empty());
+        finishMilliseconds_ = (cv::getTickCount() - finishStart) * tickMilliseconds;
+    }
+
+    size_t target = session_.remaining();
+    int64 stepStart = cv::getTickCount();
+    while (!session_.done())
+    {
+        session_.step();
+        int64 now = cv::getTickCount();
+        double elapsed = (now - start) * tickMilliseconds;
+        double stepMilliseconds = (now - stepStart) * tickMilliseconds;
+        stepStart = now;
+        if (params_.maxMilliseconds > 0 &&
+            elapsed + stepMilliseconds + std::max(finishMilliseconds_, 0.0) > params_.maxMilliseconds)
+            break;
+    }
+    inpainted_ = target - session_.remaining();
+    smoothed_ = session_.remaining();
+    const int64 finishStart = cv::getTickCount();
+
+    finish(filledColor, filledDepth, !workDepth.empty());
+
+    // keep the offsets of pixels that were not inpainted again in this frame
+    cv::Mat offsets = session_.offsets();
+    if (!offsets.empty())
+    {
+        offsets = offsets.clone();
+        if (!priorOffsets.empty())
+        {
+            for (int y = 0; y < offsets.rows; ++y)
+            {
+                cv::Vec2i* offsetRow = offsets.ptr<cv::Vec2i>(y);
+                const cv::Vec2i* priorRow = priorOffsets.ptr<cv::Vec2i>(y);
+                for (int x = 0; x < offsets.cols; ++x)
+                {
+                    if (offsetRow[x] == cv::Vec2i(0, 0))
+                        offsetRow[x] = priorRow[x];
+                }
+            }
+        }
+    }
+    prevOffsets_ = offsets;
+
+    prevColor_ = colorMat;
+    prevMask_ = maskMat.clone();
+    filledColor.copyTo(prevFilled_);
+    if (filledDepth.empty())
+        prevFilledDepth_.release();
+    else
+        filledDepth.copyTo(prevFilledDepth_);
+    ++frames_;
+
+    // the finishing time of the next frame is guessed from the recent ones
+    double finishTime = (cv::getTickCount() - finishStart) * tickMilliseconds;
+    finishMilliseconds_ = finishMilliseconds_ >= 0 ? 0.5 * (finishMilliseconds_ + finishTime) : finishTime;
+    milliseconds_ = (cv::getTickCount() - start) * tickMilliseconds;
+}
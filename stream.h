@@ -0,0 +1,78 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "utils.h"
+#include "session.h"
+#include "inpainting.h"
+
+struct StreamParams
+{
+    SearchParams search;        // exemplar search of color and depth, PatchMatch uses the previous
+                                // frame's offsets as seeds
+    ReconstructParams smooth;   // membrane fill of the target left when the budget runs out
+    float changeThreshold;      // largest color difference of a source pixel that counts as unchanged
+    double maxMilliseconds;     // budget of a whole process call, 0 for none. The exemplar loop stops
+                                // early enough to leave time for the smooth fill of the rest.
+
+    StreamParams()
+        : changeThreshold(4.0f / 255.0f), maxMilliseconds(25)
+    {
+        search.strategy = SEARCH_PATCHMATCH;
+        smooth.solver = POISSON_MULTIGRID;
+        smooth.inPlace = true;
+    }
+};
+
+/*
+ * Inpaints an RGB-D frame sequence. Target pixels that were already filled
+ * in the previous frame, color and depth, are reused when neither the mask
+ * nor the source content within a patch diameter changed, so only the
+ * changed part of the hole goes through the exemplar loop. That loop
+ * matches and fills color and depth together, is seeded with the previous
+ * frame's patch offsets and stops so the whole frame fits the time budget.
+ */
+class StreamInpainter
+{
+public:
+    explicit StreamInpainter(const StreamParams& params = StreamParams());
+
+    // color - CV_8UC3 or CV_32FC3 in [0, 1], without border
+    // depth - single channel, empty to skip the depth
+    // maskMat - CV_8UC1, 0 for the target region
+    // filledColor receives CV_32FC3 in [0, 1], filledDepth CV_32FC1
+    void process(const cv::Mat& color, const cv::Mat& depth, const cv::Mat& maskMat,
+                 cv::Mat& filledColor, cv::Mat& filledDepth);
+
+    // forget the previous frame
+    void reset();
+
+    size_t frames() const { return frames_; }
+    // target pixels of the last frame that were reused, inpainted by exemplars, or filled smoothly
+    size_t reused() const { return reused_; }
+    size_t inpainted() const { return inpainted_; }
+    size_t smoothed() const { return smoothed_; }
+    // duration of the last process call
+    double milliseconds() const { return milliseconds_; }
+
+private:
+    cv::Mat reusableMask(const cv::Mat& color, const cv::Mat& maskMat) const;
+    void fillSmooth(cv::Mat& color, cv::Mat& depth, const cv::Mat& fillRegion);
+    void finish(cv::Mat& filledColor, cv::Mat& filledDepth, bool depth);
+
+    StreamParams params_;
+    InpaintingSession session_;
+
+    cv::Mat prevColor_;         // last input color, CV_32FC3
+    cv::Mat prevMask_;          // last mask
+    cv::Mat prevFilled_;        // last filled color
+    cv::Mat prevFilledDepth_;   // last filled depth, empty without depth
+    cv::Mat prevOffsets_;       // last patch offsets, with the session's border
+
+    double finishMilliseconds_; // estimated time after the exemplar loop, kept free of the budget,
+                                // negative until measured
+    size_t frames_;
+    size_t reused_, inpainted_, smoothed_;
+    double milliseconds_;
+};
+
+#endif
@@ -1,4 +1,7 @@
  #include "utils.h"
+#include "fillfront.h"
+#include "priorityqueue.h"
+#include "isophotes.h"
 
 // utility functions needed for inpainting
 
@@ -21,7 +24,8 @@ void loadInpaintingImages(
                           cv::Mat& colorMat,
                           cv::Mat& depthMat,
                           cv::Mat& maskMat,
-                          double scale)
+                          double scale,
+                          int radius)
 {
     assert(colorFilename.length() && maskFilename.length() && depthFilename.length());
     
@@ -40,27 +44,27 @@ void loadInpaintingImages(
     colorMat.convertTo(colorMat, CV_32F);
     colorMat /= 255.0f;
 
+    // depth keeps the unit of the file, the session normalizes it
     depthMat.convertTo(depthMat, CV_32F);
-    depthMat /= 255.0f;
     
     // add border around colorMat
     cv::copyMakeBorder(
                        colorMat,
                        colorMat,
-                       RADIUS,
-                       RADIUS,
-                       RADIUS,
-                       RADIUS,
+                       radius,
+                       radius,
+                       radius,
+                       radius,
                        cv::BORDER_CONSTANT,
                        cv::Scalar_<float>(0,0,0)
                        );
     cv::copyMakeBorder(
                        depthMat,
                        depthMat,
-                       RADIUS,
-                       RADIUS,
-                       RADIUS,
-                       RADIUS,
+                       radius,
+                       radius,
+                       radius,
+                       radius,
                        cv::BORDER_CONSTANT,
                        cv::Scalar_<float>(0)
                        );
@@ -81,27 +85,14 @@ void showMat(const cv::String& winname, const cv::Mat& mat, int time/*= 5*/)
 
 
 /*
- * Extract closed boundary from mask.
+ * Get a patch of size radius around point p in mat.
  */
-void getContours(const cv::Mat& mask,
-                 contours_t& contours,
-                 hierarchy_t& hierarchy
-                 )
+cv::Mat getPatch(const cv::Mat& mat, const cv::Point& p, int radius)
 {
-    assert(mask.type() == CV_8UC1);
-    cv::findContours(mask, contours, hierarchy, CV_RETR_TREE, CV_CHAIN_APPROX_NONE);
-}
-
-
-/*
- * Get a patch of size RAIDUS around point p in mat.
- */
-cv::Mat getPatch(const cv::Mat& mat, const cv::Point& p)
-{
-    assert(RADIUS <= p.x && p.x < mat.cols-RADIUS && RADIUS <= p.y && p.y < mat.rows-RADIUS);
+    assert(radius <= p.x && p.x < mat.cols-radius && radius <= p.y && p.y < mat.rows-radius);
     return  mat(
-                 cv::Range(p.y-RADIUS, p.y+RADIUS+1),
-                 cv::Range(p.x-RADIUS, p.x+RADIUS+1)
+                 cv::Range(p.y-radius, p.y+radius+1),
+                 cv::Range(p.x-radius, p.x+radius+1)
                  );
 }
 
@@ -118,73 +109,20 @@ void getDerivatives(const cv::Mat& grayMat, cv::Mat& dx, cv::Mat& dy)
 
 
 /*
- * Get the unit normal of a dense list of boundary points centered around point p.
+ * Get the unit normal of the least squares line y = slope*x + c through n
+ * points given their sums. The 2x2 normal equations are solved in closed form.
  */
-cv::Point2f getNormal(const contour_t& contour, const cv::Point& point)
+cv::Point2f fitNormal(double n, double sumX, double sumY, double sumXX, double sumXY)
 {
-    int sz = (int) contour.size();
-    
-    assert(sz != 0);
-    
-    int pointIndex = (int) (std::find(contour.begin(), contour.end(), point) - contour.begin());
-    
-    assert(pointIndex != contour.size());
-    
-    if (sz == 1)
-    {
-        return cv::Point2f(1.0f, 0.0f);
-    } else if (sz < 2 * BORDER_RADIUS + 1)
-    {
-        // Too few points in contour to use LSTSQ regression
-        // return the normal with respect to adjacent neigbourhood
-        cv::Point adj = contour[(pointIndex + 1) % sz] - contour[pointIndex];
-        return cv::Point2f(adj.y, -adj.x) / cv::norm(adj);
-    }
-    
-    // Use least square regression
-    // create X and Y mat to SVD
-    cv::Mat X(cv::Size(2, 2*BORDER_RADIUS+1), CV_32F);
-    cv::Mat Y(cv::Size(1, 2*BORDER_RADIUS+1), CV_32F);
-    
-    assert(X.rows == Y.rows && X.cols == 2 && Y.cols == 1 && X.type() == Y.type()
-              && Y.type() == CV_32F);
-    
-    int i = mod((pointIndex - BORDER_RADIUS), sz);
+    double det = n * sumXX - sumX * sumX;
     
-    float* Xrow;
-    float* Yrow;
-    
-    int count = 0;
-    int countXequal = 0;
-    while (count < 2*BORDER_RADIUS+1)
-    {
-        Xrow = X.ptr<float>(count);
-        Xrow[0] = contour[i].x;
-        Xrow[1] = 1.0f;
-        
-        Yrow = Y.ptr<float>(count);
-        Yrow[0] = contour[i].y;
-        
-        if (Xrow[0] == contour[pointIndex].x)
-        {
-            ++countXequal;
-        }
-        
-        i = mod(i+1, sz);
-        ++count;
-    }
-    
-    if (countXequal == count)
+    // all points share the same x, the line is vertical
+    if (std::abs(det) < 1e-9)
     {
         return cv::Point2f(1.0f, 0.0f);
     }
-    // to find the line of best fit
-    cv::Mat sol;
-    cv::solve(X, Y, sol, cv::DECOMP_SVD);
     
-    assert(sol.type() == CV_32F);
-    
-    float slope = sol.ptr<float>(0)[0];
+    float slope = (float) ((n * sumXY - sumX * sumY) / det);
     cv::Point2f normal(-slope, 1);
     
     return normal / cv::norm(normal);
@@ -201,70 +139,88 @@ double computeConfidence(const cv::Mat& confidencePatch)
 
 
 /*
- * Iterate over every contour point in contours and compute the
- * priority of path centered at point using grayMat and confidenceMat
+ * Compute the priority of the patch centered at point from its confidence,
+ * the front normal and the strongest isophote in the source part of the patch.
  */
-void computePriority(const contours_t& contours, const cv::Mat& grayMat, const cv::Mat& confidenceMat, cv::Mat& priorityMat)
+static float computePointPriority(const cv::Point& point,
+                                  const FillFront& front,
+                                  const IsophoteCache& isophotes,
+                                  const cv::Mat& confidenceMat,
+                                  int radius)
 {
-    assert(grayMat.type() == CV_32FC1 &&
-              priorityMat.type() == CV_32FC1 &&
-              confidenceMat.type() == CV_32FC1
-              );
+    cv::Point maxPoint;
     
-    // define some patches
-    cv::Mat confidencePatch;
-    cv::Mat magnitudePatch;
+    // get confidence of patch
+    double confidence = computeConfidence(getPatch(confidenceMat, point, radius));
+    assert(0 <= confidence && confidence <= 1.0f);
     
-    cv::Point2f normal;
-    cv::Point maxPoint;
-    cv::Point2f gradient;
+    // get the normal to the border around point
+    cv::Point2f normal = front.normal(point);
     
-    double confidence;
+    // get the maximum gradient in source around patch
+    cv::minMaxLoc(getPatch(isophotes.maskedMagnitude(), point, radius), NULL, NULL, NULL, &maxPoint);
+    cv::Point2f gradient = cv::Point2f(
+                                       -getPatch(isophotes.dy(), point, radius).ptr<float>(maxPoint.y)[maxPoint.x],
+                                       getPatch(isophotes.dx(), point, radius).ptr<float>(maxPoint.y)[maxPoint.x]
+                                     );
     
-    // get the derivatives and magnitude of the greyscale image
-    cv::Mat dx, dy, magnitude;
-    getDerivatives(grayMat, dx, dy);
-    cv::magnitude(dx, dy, magnitude);
+    float priority = std::abs((float) confidence * gradient.dot(normal));
+    assert(priority >= 0);
+    return priority;
+}
+
+
+/*
+ * Iterate over every point of the fill front and queue the
+ * priority of path centered at point using isophotes and confidenceMat
+ */
+void computePriority(const FillFront& front, const IsophoteCache& isophotes, const cv::Mat& confidenceMat, PriorityQueue& queue,
+                     int radius)
+{
+    assert(confidenceMat.type() == CV_32FC1);
     
-    // mask the magnitude
-    cv::Mat maskedMagnitude(magnitude.size(), magnitude.type(), cv::Scalar_<float>(0));
-    magnitude.copyTo(maskedMagnitude, (confidenceMat != 0.0f));
-    cv::erode(maskedMagnitude, maskedMagnitude, cv::Mat());
+    queue.reset(confidenceMat.size());
     
-    assert(maskedMagnitude.type() == CV_32FC1);
+    const contour_t& points = front.points();
     
-    // for each point in contour
-    cv::Point point;
+    for (int i = 0; i < points.size(); ++i)
+    {
+        queue.push(points[i], computePointPriority(points[i], front, isophotes, confidenceMat, radius));
+    }
+}
+
+
+/*
+ * After the patch centered at psiHatP has been filled and front updated,
+ * drop the points that left the front and recompute the priorities that
+ * depend on the filled patch. A front point is affected when its patch
+ * overlaps the changed confidence and isophotes (2*radius + 2 away, the
+ * Sobel and erode kernels each reach one pixel further) or when its normal
+ * window overlaps the changed front (radius + 1 + BORDER_RADIUS away).
+ */
+void updatePriority(const FillFront& front, const cv::Point& psiHatP, const IsophoteCache& isophotes, const cv::Mat& confidenceMat, PriorityQueue& queue,
+                    int radius)
+{
+    assert(confidenceMat.type() == CV_32FC1);
+    
+    const int reach = std::max(2*radius + 2, radius + 1 + BORDER_RADIUS);
+    int y0 = std::max(psiHatP.y - reach, 0);
+    int y1 = std::min(psiHatP.y + reach, confidenceMat.rows - 1);
+    int x0 = std::max(psiHatP.x - reach, 0);
+    int x1 = std::min(psiHatP.x + reach, confidenceMat.cols - 1);
     
-    for (int i = 0; i < contours.size(); ++i)
+    cv::Point point;
+    for (point.y = y0; point.y <= y1; ++point.y)
     {
-        contour_t contour = contours[i];
-        
-        for (int j = 0; j < contour.size(); ++j)
+        for (point.x = x0; point.x <= x1; ++point.x)
         {
-            
-            point = contour[j];
-            
-            confidencePatch = getPatch(confidenceMat, point);
-            
-            // get confidence of patch
-            confidence = cv::sum(confidencePatch)[0] / (double) confidencePatch.total();
-            assert(0 <= confidence && confidence <= 1.0f);
-            
-            // get the normal to the border around point
-            normal = getNormal(contour, point);
-            
-            // get the maximum gradient in source around patch
-            magnitudePatch = getPatch(maskedMagnitude, point);
-            cv::minMaxLoc(magnitudePatch, NULL, NULL, NULL, &maxPoint);
-            gradient = cv::Point2f(
-                                   -getPatch(dy, point).ptr<float>(maxPoint.y)[maxPoint.x],
-                                   getPatch(dx, point).ptr<float>(maxPoint.y)[maxPoint.x]
-                                 );
-            
-            // set the priority in priorityMat
-            priorityMat.ptr<float>(point.y)[point.x] = std::abs((float) confidence * gradient.dot(normal));
-            assert(priorityMat.ptr<float>(point.y)[point.x] >= 0);
+            if (front.contains(point))
+            {
+                queue.push(point, computePointPriority(point, front, isophotes, confidenceMat, radius));
+            } else if (queue.contains(point))
+            {
+                queue.erase(point);
+            }
         }
     }
 }
@@ -274,15 +230,34 @@ void computePriority(const contours_t& contours, const cv::Mat& grayMat, const c
  * Transfer the values from patch centered at psiHatQ to patch centered at psiHatP in
  * mat according to maskMat.
  */
-void transferPatch(const cv::Point& psiHatQ, const cv::Point& psiHatP, cv::Mat& mat, const cv::Mat& maskMat)
+void transferPatch(const cv::Point& psiHatQ, const cv::Point& psiHatP, cv::Mat& mat, const cv::Mat& maskMat,
+                   int radius)
 {
     assert(maskMat.type() == CV_8U);
     assert(mat.size() == maskMat.size());
-    assert(RADIUS <= psiHatQ.x && psiHatQ.x < mat.cols-RADIUS && RADIUS <= psiHatQ.y && psiHatQ.y < mat.rows-RADIUS);
-    assert(RADIUS <= psiHatP.x && psiHatP.x < mat.cols-RADIUS && RADIUS <= psiHatP.y && psiHatP.y < mat.rows-RADIUS);
+    assert(radius <= psiHatQ.x && psiHatQ.x < mat.cols-radius && radius <= psiHatQ.y && psiHatQ.y < mat.rows-radius);
+    assert(radius <= psiHatP.x && psiHatP.x < mat.cols-radius && radius <= psiHatP.y && psiHatP.y < mat.rows-radius);
     
     // copy contents of psiHatQ to psiHatP with mask
-    getPatch(mat, psiHatQ).copyTo(getPatch(mat, psiHatP), getPatch(maskMat, psiHatP));
+    getPatch(mat, psiHatQ, radius).copyTo(getPatch(mat, psiHatP, radius), getPatch(maskMat, psiHatP, radius));
+}
+
+/*
+ * Map the depth range of the source pixels (maskMat non zero) to [0, 1] as
+ * normalized = depth * scale + offset, the range color has in the patch
+ * distance. Any depth unit works. A flat range only shifts depth to 0.
+ */
+void normalizeDepth(const cv::Mat& depth, const cv::Mat& maskMat, cv::Mat& normalized, double& scale, double& offset)
+{
+    assert(depth.channels() == 1 && maskMat.type() == CV_8UC1 && depth.size() == maskMat.size());
+
+    double lo = 0.0, hi = 0.0;
+    if (cv::countNonZero(maskMat) > 0)
+        cv::minMaxLoc(depth, &lo, &hi, NULL, NULL, maskMat);
+
+    scale = hi > lo ? 1.0 / (hi - lo) : 1.0;
+    offset = -lo * scale;
+    depth.convertTo(normalized, CV_32F, scale, offset);
 }
 
 /*
@@ -292,7 +267,7 @@ void transferPatch(const cv::Point& psiHatQ, const cv::Point& psiHatP, cv::Mat&
  */
 cv::Mat computeSSD(const cv::Mat& tmplate, const cv::Mat& source, const cv::Mat& tmplateMask)
 {
-    assert(tmplate.type() == CV_32FC3 && source.type() == CV_32FC3);
+    assert((tmplate.type() == CV_32FC3 || tmplate.type() == CV_32FC4) && source.type() == tmplate.type());
     assert(tmplate.rows <= source.rows && tmplate.cols <= source.cols);
     assert(tmplateMask.size() == tmplate.size() && tmplate.type() == tmplateMask.type());
     
@@ -305,7 +280,10 @@ cv::Mat computeSSD(const cv::Mat& tmplate, const cv::Mat& source, const cv::Mat&
                       tmplateMask
                       );
     cv::normalize(result, result, 0, 1, cv::NORM_MINMAX);
-    cv::copyMakeBorder(result, result, RADIUS, RADIUS, RADIUS, RADIUS, cv::BORDER_CONSTANT, 1.1f);
+    
+    // back to the size of source, the template radius is the border
+    int radius = tmplate.rows / 2;
+    cv::copyMakeBorder(result, result, radius, radius, radius, radius, cv::BORDER_CONSTANT, 1.1f);
     
     return result;
 }
@@ -13,12 +13,14 @@
 #include <iostream>
 #include <cmath>
 
-typedef std::vector<std::vector<cv::Point>> contours_t;
-typedef std::vector<cv::Vec4i> hierarchy_t;
 typedef std::vector<cv::Point> contour_t;
 
+class FillFront;
+class PriorityQueue;
+class IsophoteCache;
 
-// Patch raduius
+
+// Default patch raduius, the radius is a runtime parameter (SearchParams::radius)
 #define RADIUS 5
 // The maximum number of pixels around a specified point on the target outline
 #define BORDER_RADIUS 5
@@ -32,23 +34,29 @@ void loadInpaintingImages(
                           cv::Mat& colorMat,
                           cv::Mat& depthMat,
                           cv::Mat& maskMat,
-                          double scale);
+                          double scale,
+                          int radius = RADIUS);
 
 void showMat(const cv::String& winname, const cv::Mat& mat, int time=500);
 
-void getContours(const cv::Mat& mask, contours_t& contours, hierarchy_t& hierarchy);
-
 double computeConfidence(const cv::Mat& confidencePatch);
 
-cv::Mat getPatch(const cv::Mat& image, const cv::Point& p);
+cv::Mat getPatch(const cv::Mat& image, const cv::Point& p, int radius = RADIUS);
 
 void getDerivatives(const cv::Mat& grayMat, cv::Mat& dx, cv::Mat& dy);
 
-cv::Point2f getNormal(const contour_t& contour, const cv::Point& point);
+cv::Point2f fitNormal(double n, double sumX, double sumY, double sumXX, double sumXY);
+
+void computePriority(const FillFront& front, const IsophoteCache& isophotes, const cv::Mat& confidenceMat, PriorityQueue& queue,
+                     int radius = RADIUS);
+
+void updatePriority(const FillFront& front, const cv::Point& psiHatP, const IsophoteCache& isophotes, const cv::Mat& confidenceMat, PriorityQueue& queue,
+                    int radius = RADIUS);
 
-void computePriority(const contours_t& contours, const cv::Mat& grayMat, const cv::Mat& confidenceMat, cv::Mat& priorityMat);
+void transferPatch(const cv::Point& psiHatQ, const cv::Point& psiHatP, cv::Mat& mat, const cv::Mat& maskMat,
+                   int radius = RADIUS);
 
-void transferPatch(const cv::Point& psiHatQ, const cv::Point& psiHatP, cv::Mat& mat, const cv::Mat& maskMat);
+void normalizeDepth(const cv::Mat& depth, const cv::Mat& maskMat, cv::Mat& normalized, double& scale, double& offset);
 
 cv::Mat computeSSD(const cv::Mat& tmplate, const cv::Mat& source, const cv::Mat& tmplateMask);
 